@@ -9,10 +9,6 @@
 ***** CONSTANTS ************
 ***************************/
 
-#define TASK_CORE                 1
-#define TASK_PRIO                 1
-#define STACK_SIZE             4096
-
 #define BUTTON_PIN      GPIO_NUM_22
 #define BUTTON_ACTIVE             0
 #define BUTTON_DELAY_MS         100
@@ -36,21 +32,20 @@
 ***** LOCAL FUNCTIONS ******
 ***************************/
 
-static void button_task(void *param);
+static void button_isr(void *arg);
 
 /***************************
 ***** LOCAL VARIABLES ******
 ***************************/
 
-static TaskHandle_t handle;
 static msg_type_t   msg_type;
+static TickType_t   last_edge;
 
 /***************************
 ***** PUBLIC FUNCTIONS *****
 ***************************/
 
 void button_init(void) {
-    assert(!handle);
     assert(!msg_type);
 
     msg_type = msg_register();
@@ -60,11 +55,14 @@ void button_init(void) {
     io_conf.pin_bit_mask = BIT64(BUTTON_PIN);
     io_conf.mode = GPIO_MODE_INPUT;
     io_conf.pull_up_en = GPIO_PULLUP_ENABLE;
+    io_conf.intr_type = GPIO_INTR_ANYEDGE;
     ESP_ERROR_CHECK(gpio_config(&io_conf));
 
-    if (xTaskCreatePinnedToCore(&button_task, "button-task", STACK_SIZE, NULL, TASK_PRIO, &handle, TASK_CORE) != pdPASS) {
-        LOGE("could not create task");
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(err);
     }
+    ESP_ERROR_CHECK(gpio_isr_handler_add(BUTTON_PIN, &button_isr, NULL));
 }
 
 msg_type_t button_msg_type(void) {
@@ -76,20 +74,17 @@ msg_type_t button_msg_type(void) {
 ***** LOCAL FUNCTIONS ******
 ***************************/
 
-static void button_task(void *param) {
-    uint8_t button_cnt = 0;
-    for (;;) {
-        if (gpio_get_level(BUTTON_PIN) == BUTTON_ACTIVE) {
-            if (button_cnt < BUTTON_DELAY_MS / 10) {
-                button_cnt++;
-                if (button_cnt == BUTTON_DELAY_MS / 10) {
-                    LOGI("BUTTON pressed!");
-                    msg_send_value(msg_type, BUTTON_PRESSED);
-                }
-            }
-        } else {
-            button_cnt = 0;
-        }
-        vTaskDelay(pdMS_TO_TICKS(10));
+// a press is an edge to the active level after the line was quiet for
+// BUTTON_DELAY_MS, which also swallows the bounces of the release
+static void button_isr(void *arg) {
+    TickType_t now = xTaskGetTickCountFromISR();
+    BaseType_t woken = pdFALSE;
+    if (   (gpio_get_level(BUTTON_PIN) == BUTTON_ACTIVE)
+        && (now - last_edge >= pdMS_TO_TICKS(BUTTON_DELAY_MS))) {
+        msg_send_value_from_isr(msg_type, BUTTON_PRESSED, &woken);
+    }
+    last_edge = now;
+    if (woken) {
+        portYIELD_FROM_ISR();
     }
 }
@@ -1,3 +1,4 @@
+#include <assert.h>
 #include <dirent.h>
 #include <esp_log.h>
 #include <esp_vfs_fat.h>
@@ -52,8 +53,10 @@ static char *fs_get_content_type(const char *filename);
 ***************************/
 
 static SemaphoreHandle_t mutex;
+static msg_type_t msg_type;
 static cJSON *wifi_cfg;
 static FILE *fd_table[MAX_FILES_OPEN];
+static bool fd_write[MAX_FILES_OPEN];
 static content_type_mapping_t content_type_mapping[] = {
     { ".html", "text/html"              },
     { ".css" , "text/css"               },
@@ -67,6 +70,7 @@ static content_type_mapping_t content_type_mapping[] = {
 
 void fs_init(void) {
     mutex = xSemaphoreCreateMutex();
+    msg_type = msg_register();
     esp_vfs_fat_mount_config_t fat_config = {
         .format_if_mount_failed = true,
         .max_files = 1,
@@ -105,6 +109,11 @@ cJSON *fs_get_wifi_cfg(void) {
     return wifi_cfg;
 }
 
+msg_type_t fs_msg_type(void) {
+    assert(msg_type);
+    return msg_type;
+}
+
 void fs_free_wifi_cfg(bool save) {
     if (save) {
         FILE *f = fopen(WIFI_CFG_FILE, "w");
@@ -114,6 +123,7 @@ void fs_free_wifi_cfg(bool save) {
             fwrite(buf, strlen(buf), 1, f);
             free(buf);
             fclose(f);
+            msg_send_value(msg_type, FS_WIFI_CFG_CHANGED);
         } else {
             LOGE("could not open %s", WIFI_CFG_FILE);
         }
@@ -170,6 +180,7 @@ int fs_web_open(const char *filename, fs_mode_t mode, char **content_type) {
                 char full_name[sizeof(WEB_DIR) + 1 + FS_MAX_FILENAME_LEN];
                 sprintf(full_name, "%s%s", WEB_DIR, filename);
                 fd_table[i] = fopen(full_name, mode == FS_WEB_WRITE ? "w" : "r");
+                fd_write[i] = mode == FS_WEB_WRITE;
                 if (fd_table[i]) {
                     ret = i;
                 }
@@ -217,6 +228,9 @@ void fs_web_close(int fd) {
     {
         fclose(fd_table[fd]);
         fd_table[fd] = NULL;
+        if (fd_write[fd]) {
+            msg_send_value(msg_type, FS_WEB_CHANGED);
+        }
     }
 }
 
@@ -224,7 +238,9 @@ void fs_web_delete(const char *filename) {
     if (fs_check_filename(filename)) {
         char full_name[sizeof(WEB_DIR) + 1 + FS_MAX_FILENAME_LEN];
         sprintf(full_name, "%s%s", WEB_DIR, filename);
-        remove(full_name);
+        if (!remove(full_name)) {
+            msg_send_value(msg_type, FS_WEB_CHANGED);
+        }
     }
 }
 
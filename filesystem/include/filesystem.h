@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "message.h"
+
 /********************
 ***** CONSTANTS *****
 ********************/
@@ -11,6 +13,9 @@
 #define FS_NUMBER_OF_WEB_FILES      10
 #define FS_MAX_FILENAME_LEN         32
 
+#define FS_WEB_CHANGED              1
+#define FS_WIFI_CFG_CHANGED         2
+
 /********************
 ***** MACROS ********
 ********************/
@@ -42,13 +47,14 @@ typedef enum {
 ***** FUNCTIONS *****
 ********************/
 
-void     fs_init(void);
-cJSON   *fs_get_wifi_cfg(void);
-void     fs_free_wifi_cfg(bool save);
-void     fs_web_info(fs_web_info_t *info);
-bool     fs_web_exist(const char *filename);
-int      fs_web_open(const char *filename, fs_mode_t mode, char **content_type);
-int16_t  fs_web_read(int fd, char *data, int16_t len);
-int16_t  fs_web_write(int fd, const char *data, int16_t len);
-void     fs_web_close(int fd);
-void     fs_web_delete(const char *filename);
+void        fs_init(void);
+msg_type_t  fs_msg_type(void);
+cJSON       *fs_get_wifi_cfg(void);
+void        fs_free_wifi_cfg(bool save);
+void        fs_web_info(fs_web_info_t *info);
+bool        fs_web_exist(const char *filename);
+int         fs_web_open(const char *filename, fs_mode_t mode, char **content_type);
+int16_t     fs_web_read(int fd, char *data, int16_t len);
+int16_t     fs_web_write(int fd, const char *data, int16_t len);
+void        fs_web_close(int fd);
+void        fs_web_delete(const char *filename);
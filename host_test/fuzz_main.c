@@ -0,0 +1,81 @@
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// runs the fuzz target over files and directories of inputs once each, for
+// compilers without libFuzzer, failures show up through the sanitizers
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static size_t run(const char *path);
+static size_t run_file(const char *file);
+
+/***************************
+***** PUBLIC FUNCTIONS *****
+***************************/
+
+int main(int argc, char **argv) {
+    size_t inputs = 0;
+    LLVMFuzzerInitialize(&argc, &argv);
+    for (int i = 1; i < argc; ++i) {
+        inputs += run(argv[i]);
+    }
+    printf("%zu inputs\n", inputs);
+    return !inputs;
+}
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static size_t run(const char *path) {
+    struct stat st;
+    if (stat(path, &st)) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        return 0;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return run_file(path);
+    }
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    size_t inputs = 0;
+    while (dir && (entry = readdir(dir))) {
+        char file[4096];
+        if (entry->d_name[0] != '.' && snprintf(file, sizeof(file), "%s/%s", path, entry->d_name) < sizeof(file)) {
+            inputs += run(file);
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    return inputs;
+}
+
+static size_t run_file(const char *file) {
+    FILE *f = fopen(file, "rb");
+    if (!f) {
+        fprintf(stderr, "%s: cannot read\n", file);
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = size >= 0 ? malloc(size + 1) : NULL;
+    bool read = data && fread(data, 1, size, f) == (size_t)size;
+    fclose(f);
+    if (read) {
+        LLVMFuzzerTestOneInput(data, size);
+    }
+    free(data);
+    return read;
+}
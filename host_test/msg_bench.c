@@ -0,0 +1,344 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "message.h"
+
+// drives one topic from a number of producer threads into a number of
+// handles and reports throughput, delivery latency and queue high-water marks;
+// with -q the same load runs through the design the bus replaced, one
+// FreeRTOS queue per receiver filled under a single send mutex; it fails if
+// the block policy loses a message or a pool block is still in use at the end
+
+/***************************
+***** CONSTANTS ************
+***************************/
+
+#define MAX_CONSUMERS (CONFIG_MSG_MAX_HANDLES)
+#define MAX_BATCH     64
+#define POLL_MS       10
+
+/***************************
+***** MACROS ***************
+***************************/
+
+/***************************
+***** TYPES ****************
+***************************/
+
+typedef struct {
+    msg_handle_t handle;
+    QueueHandle_t queue;
+    uint32_t *latency;
+    atomic_size_t got;
+} consumer_t;
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static void usage(const char *name);
+static void *producer(void *param);
+static void baseline_send(uint32_t value);
+static void *consumer(void *param);
+static void consume(void *ctx, const msg_t *msg);
+static void record(consumer_t *c, const msg_t *msg);
+static int compare(const void *a, const void *b);
+
+/***************************
+***** LOCAL VARIABLES ******
+***************************/
+
+static msg_type_t type;
+static size_t messages = 100000;
+static size_t size;
+static size_t batch = 1;
+static size_t total;
+static size_t consumers = 1;
+static consumer_t *receivers;
+static bool baseline;
+static SemaphoreHandle_t send_mutex;
+static pthread_barrier_t barrier;
+
+/***************************
+***** PUBLIC FUNCTIONS *****
+***************************/
+
+int main(int argc, char **argv) {
+    size_t producers = 1;
+    bool callbacks = false;
+    msg_listen_cfg_t cfg = {
+        .policy = MSG_BLOCK,
+        .timeout_ms = portMAX_DELAY
+    };
+    const char *policy = "block";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:c:n:s:o:b:kqh")) != -1) {
+        switch (opt) {
+            case 'p':
+                producers = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                consumers = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                messages = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                size = strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+                policy = optarg;
+                break;
+            case 'b':
+                batch = strtoul(optarg, NULL, 0);
+                break;
+            case 'k':
+                callbacks = true;
+                break;
+            case 'q':
+                baseline = true;
+                break;
+            default:
+                usage(argv[0]);
+                return opt != 'h';
+        }
+    }
+    if (!strcmp(policy, "newest")) {
+        cfg.policy = MSG_DROP_NEWEST;
+    } else if (!strcmp(policy, "oldest")) {
+        cfg.policy = MSG_DROP_OLDEST;
+    } else if (!strcmp(policy, "coalesce")) {
+        cfg.policy = MSG_COALESCE;
+    } else if (strcmp(policy, "block")) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!producers || !consumers || consumers > MAX_CONSUMERS || !messages || (size && size < sizeof(uint32_t)) || !batch || batch > MAX_BATCH) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (baseline && (callbacks || size || cfg.policy != MSG_BLOCK || batch > 1)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (callbacks) {
+        // callback handles always drop the newest message when they are full
+        policy = "newest";
+    }
+
+    msg_init();
+    type = msg_register();
+    total = producers * messages;
+    consumer_t *c = calloc(consumers, sizeof(consumer_t));
+    receivers = c;
+    pthread_t *thread = calloc(producers + consumers, sizeof(pthread_t));
+    assert(c && thread);
+    for (size_t i = 0; i < consumers; ++i) {
+        c[i].latency = malloc(total * sizeof(uint32_t));
+        assert(c[i].latency);
+        if (baseline) {
+            c[i].queue = xQueueCreate(CONFIG_MSG_QUEUE_LENGTH, sizeof(msg_t));
+            assert(c[i].queue);
+        } else {
+            c[i].handle = callbacks ? msg_subscribe(type, consume, &c[i]) : msg_listen_cfg(type, &cfg);
+        }
+    }
+    if (baseline) {
+        send_mutex = xSemaphoreCreateMutex();
+        assert(send_mutex);
+    }
+
+    pthread_barrier_init(&barrier, NULL, producers + 1);
+    for (size_t i = 0; !callbacks && i < consumers; ++i) {
+        pthread_create(&thread[producers + i], NULL, consumer, &c[i]);
+    }
+    for (size_t i = 0; i < producers; ++i) {
+        pthread_create(&thread[i], NULL, producer, NULL);
+    }
+    pthread_barrier_wait(&barrier);
+    int64_t start = esp_timer_get_time();
+    for (size_t i = 0; i < producers; ++i) {
+        pthread_join(thread[i], NULL);
+    }
+    int64_t sent = esp_timer_get_time();
+    for (size_t i = 0; i < consumers; ++i) {
+        if (callbacks) {
+            while (atomic_load(&c[i].got) + msg_dropped(c[i].handle) < total) {
+                vTaskDelay(1);
+            }
+        } else {
+            pthread_join(thread[producers + i], NULL);
+        }
+    }
+    int64_t end = esp_timer_get_time();
+
+    bool ok = true;
+    size_t received = 0;
+    size_t dropped = 0;
+    for (size_t i = 0; i < consumers; ++i) {
+        received += atomic_load(&c[i].got);
+        dropped += baseline ? 0 : msg_dropped(c[i].handle);
+    }
+    printf("%zu producers, %zu consumers %s, policy %s, %s%s\n", producers, consumers, callbacks ? "on callbacks" : "on tasks", policy,
+        size ? "pointer messages" : "values", baseline ? ", queue and mutex baseline" : "");
+    printf("sent %zu in %lld ms, received %zu, dropped %zu in %lld ms\n", total, (long long)(sent - start) / 1000, received, dropped,
+        (long long)(end - start) / 1000);
+    printf("%.0f msgs/s sent, %.0f msgs/s delivered\n", total * 1e6 / (sent - start + 1), received * 1e6 / (end - start + 1));
+
+    uint32_t *latency = malloc((received + 1) * sizeof(uint32_t));
+    assert(latency);
+    size_t n = 0;
+    for (size_t i = 0; i < consumers; ++i) {
+        memcpy(latency + n, c[i].latency, atomic_load(&c[i].got) * sizeof(uint32_t));
+        n += atomic_load(&c[i].got);
+    }
+    qsort(latency, n, sizeof(uint32_t), compare);
+    if (n) {
+        printf("latency p50 %u us, p99 %u us, max %u us\n", latency[n / 2], latency[n * 99 / 100], latency[n - 1]);
+    }
+    for (size_t i = 0; cfg.policy == MSG_BLOCK && !callbacks && i < consumers; ++i) {
+        if (atomic_load(&c[i].got) != total) {
+            printf("consumer %zu received %zu of %zu with the block policy\n", i, atomic_load(&c[i].got), total);
+            ok = false;
+        }
+    }
+    for (size_t i = 0; !baseline && i < consumers; ++i) {
+        msg_handle_stats_t stats;
+        if (msg_stats_handle(c[i].handle, &stats)) {
+            printf("handle %u: high water %u, received %u, dropped %u\n", c[i].handle, stats.high_water, stats.received, stats.dropped);
+        }
+    }
+
+    // a dispatcher may still be releasing the payload of its last callback
+    msg_pool_stats_t pool[4];
+    size_t pools;
+    size_t used;
+    for (int tries = 0;; ++tries) {
+        pools = msg_pool_stats(pool, sizeof(pool) / sizeof(pool[0]));
+        used = 0;
+        for (size_t i = 0; i < pools; ++i) {
+            used += pool[i].used;
+        }
+        if (!used || tries == 100) {
+            break;
+        }
+        vTaskDelay(POLL_MS);
+    }
+    for (size_t i = 0; (size || used) && i < pools; ++i) {
+        printf("pool %u: %u blocks, %u used, peak %u, failed %u\n", pool[i].size, pool[i].blocks, pool[i].used, pool[i].peak, pool[i].failed);
+    }
+    if (used) {
+        printf("%zu pool blocks still in use\n", used);
+        ok = false;
+    }
+
+    // the bus is never torn down, only what the benchmark allocated itself
+    free(latency);
+    for (size_t i = 0; i < consumers; ++i) {
+        free(c[i].latency);
+        if (baseline) {
+            vQueueDelete(c[i].queue);
+        }
+    }
+    if (baseline) {
+        vSemaphoreDelete(send_mutex);
+    }
+    free(thread);
+    free(c);
+    pthread_barrier_destroy(&barrier);
+    return !ok;
+}
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-p producers] [-c consumers] [-n messages] [-s size] [-o policy] [-b batch] [-k] [-q] [-h]\n"
+        "  -p  threads publishing on one topic, default 1\n"
+        "  -c  handles listening to it, at most %d, default 1\n"
+        "  -n  messages per producer, default 100000\n"
+        "  -s  send msg_alloc payloads of size bytes (at least 4) instead of values\n"
+        "  -o  newest, oldest, block or coalesce, default block\n"
+        "  -b  messages taken per msg_receive_batch, at most %d, default 1\n"
+        "  -k  consume through msg_subscribe callbacks, these drop the newest message\n"
+        "  -q  send values through a queue per consumer under one mutex instead, as\n"
+        "      the bus did before its rings, only with the block policy and batch 1\n",
+        name, MAX_CONSUMERS, MAX_BATCH);
+}
+
+// the send time travels in the value or at the start of the payload
+static void *producer(void *param) {
+    pthread_barrier_wait(&barrier);
+    for (size_t i = 0; i < messages; ++i) {
+        uint32_t now = esp_timer_get_time();
+        if (baseline) {
+            baseline_send(now);
+        } else if (size) {
+            uint32_t *payload = msg_alloc(size, NULL);
+            assert(payload);
+            *payload = now;
+            msg_send_ptr(type, payload);
+        } else {
+            msg_send_value(type, now);
+        }
+    }
+    return NULL;
+}
+
+// the former msg_send_value, but waiting for space where it asserted
+static void baseline_send(uint32_t value) {
+    msg_t msg = {
+        .type = type,
+        .value = value
+    };
+    xSemaphoreTake(send_mutex, portMAX_DELAY);
+    for (size_t i = 0; i < consumers; ++i) {
+        xQueueSendToBack(receivers[i].queue, &msg, portMAX_DELAY);
+    }
+    xSemaphoreGive(send_mutex);
+}
+
+static void *consumer(void *param) {
+    consumer_t *c = param;
+    msg_t msg[MAX_BATCH];
+    while (atomic_load(&c->got) + (baseline ? 0 : msg_dropped(c->handle)) < total) {
+        size_t cnt = baseline ? xQueueReceive(c->queue, msg, POLL_MS) == pdPASS : msg_receive_batch(c->handle, msg, batch, POLL_MS);
+        for (size_t i = 0; i < cnt; ++i) {
+            record(c, &msg[i]);
+            if (msg[i].is_ptr) {
+                msg_free(&msg[i]);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void consume(void *ctx, const msg_t *msg) {
+    record(ctx, msg);
+}
+
+static void record(consumer_t *c, const msg_t *msg) {
+    uint32_t now = esp_timer_get_time();
+    uint32_t stamp = msg->is_ptr ? *(uint32_t *)msg->ptr : msg->value;
+    size_t got = atomic_load_explicit(&c->got, memory_order_relaxed);
+    c->latency[got] = now - stamp;
+    atomic_store_explicit(&c->got, got + 1, memory_order_release);
+}
+
+static int compare(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
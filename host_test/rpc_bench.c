@@ -0,0 +1,259 @@
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <esp_timer.h>
+
+#include "rpc_methods.h"
+
+// replays request files against the dashboard methods and reports requests
+// per second, the size of request and response, heap allocations and bytes
+// per request and the heap peak, files ending in .cbor go through the CBOR
+// entry point, all others are JSON text; a lookup run then calls methods
+// from all over a table of RPC_METHODS_GENERATED and compares with the
+// linear strcmp scan the sorted index replaced
+
+/***************************
+***** CONSTANTS ************
+***************************/
+
+/***************************
+***** MACROS ***************
+***************************/
+
+/***************************
+***** TYPES ****************
+***************************/
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_aligned_alloc(size_t alignment, size_t size);
+void  __real_free(void *ptr);
+
+static void usage(const char *name);
+static bool replay(const char *file, size_t rounds);
+static void *load(const char *file, size_t *len);
+static size_t handle(const void *request, size_t len, bool cbor);
+static void count(void *ptr, size_t size);
+static void lookup(size_t rounds);
+static int compare(const void *a, const void *b);
+
+/***************************
+***** LOCAL VARIABLES ******
+***************************/
+
+// dispatcher tasks allocate too, so the counters are shared
+static atomic_size_t allocs;
+static atomic_size_t bytes;
+static atomic_size_t live;
+static atomic_size_t peak;
+
+/***************************
+***** PUBLIC FUNCTIONS *****
+***************************/
+
+int main(int argc, char **argv) {
+    size_t rounds = 10000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                rounds = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return opt != 'h';
+        }
+    }
+    if (!rounds) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    rpc_methods_init();
+    for (int i = optind; i < argc; ++i) {
+        if (!replay(argv[i], rounds)) {
+            return 1;
+        }
+    }
+    lookup(rounds);
+    return 0;
+}
+
+// counts every allocation of the components and cJSON, linked in with
+// -Wl,--wrap so the libc allocator stays underneath
+void *__wrap_malloc(size_t size) {
+    void *ptr = __real_malloc(size);
+    count(ptr, size);
+    return ptr;
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    void *ptr = __real_calloc(n, size);
+    count(ptr, n * size);
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    if (ptr) {
+        atomic_fetch_sub(&live, malloc_usable_size(ptr));
+    }
+    ptr = __real_realloc(ptr, size);
+    count(ptr, size);
+    return ptr;
+}
+
+void *__wrap_aligned_alloc(size_t alignment, size_t size) {
+    void *ptr = __real_aligned_alloc(alignment, size);
+    count(ptr, size);
+    return ptr;
+}
+
+void __wrap_free(void *ptr) {
+    if (ptr) {
+        atomic_fetch_sub(&live, malloc_usable_size(ptr));
+    }
+    __real_free(ptr);
+}
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-n rounds] [-h] [file...]\n"
+        "  -n  times each file and each lookup is handled, default 10000\n",
+        name);
+}
+
+// the first round fills the caches and is not measured, the peak is taken
+// above what was live before the file
+static bool replay(const char *file, size_t rounds) {
+    size_t len;
+    void *request = load(file, &len);
+    if (!request) {
+        fprintf(stderr, "%s: cannot read\n", file);
+        return false;
+    }
+    const char *ext = strrchr(file, '.');
+    bool cbor = ext && !strcmp(ext, ".cbor");
+    size_t out = handle(request, len, cbor);
+
+    size_t sent = rpc_methods_sent();
+    size_t base = atomic_load(&live);
+    atomic_store(&allocs, 0);
+    atomic_store(&bytes, 0);
+    atomic_store(&peak, base);
+    int64_t start = esp_timer_get_time();
+    for (size_t i = 0; i < rounds; ++i) {
+        handle(request, len, cbor);
+    }
+    int64_t end = esp_timer_get_time();
+
+    const char *name = strrchr(file, '/');
+    printf("%-28s %9.0f req/s %5zu in %5zu out %6.1f allocs/req %8.0f bytes/req %7zu peak", name ? name + 1 : file,
+        rounds * 1e6 / (end - start + 1), len, out, (double)atomic_load(&allocs) / rounds, (double)atomic_load(&bytes) / rounds, atomic_load(&peak) - base);
+    if (rpc_methods_sent() != sent) {
+        printf(" %zu async", rpc_methods_sent() - sent);
+    }
+    printf("\n");
+    free(request);
+    return true;
+}
+
+// NUL-terminated so JSON text can be handed over as it is
+static void *load(const char *file, size_t *len) {
+    FILE *f = fopen(file, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = size >= 0 ? malloc(size + 1) : NULL;
+    if (data && fread(data, 1, size, f) == (size_t)size) {
+        data[size] = '\0';
+        *len = size;
+    } else {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+// returns the size of the response, 0 if there is none
+static size_t handle(const void *request, size_t len, bool cbor) {
+    size_t response_len = 0;
+    if (cbor) {
+        uint8_t *response = json_rpc_handle_request_cbor(NULL, request, len, &response_len);
+        if (!response) {
+            response_len = 0;
+        }
+        free(response);
+    } else {
+        char *response = json_rpc_handle_request(NULL, request);
+        response_len = response ? strlen(response) : 0;
+        free(response);
+    }
+    return response_len;
+}
+
+static void count(void *ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bytes, size, memory_order_relaxed);
+    size_t now = atomic_fetch_add(&live, malloc_usable_size(ptr)) + malloc_usable_size(ptr);
+    size_t max = atomic_load(&peak);
+    while (now > max && !atomic_compare_exchange_weak(&peak, &max, now)) {
+    }
+}
+
+// the first, middle and last name in sorted order and one that is missing,
+// each as a whole request and as the bare linear scan
+static void lookup(size_t rounds) {
+    const json_rpc_config_t *cfg;
+    json_rpc_server_t *server = rpc_methods_generated(&cfg);
+    const char *sorted[RPC_METHODS_GENERATED];
+    for (size_t i = 0; i < RPC_METHODS_GENERATED; ++i) {
+        sorted[i] = cfg[i].method;
+    }
+    qsort(sorted, RPC_METHODS_GENERATED, sizeof(sorted[0]), compare);
+    const char *names[] = { sorted[0], sorted[RPC_METHODS_GENERATED / 2], sorted[RPC_METHODS_GENERATED - 1], "unknown-method" };
+
+    for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); ++n) {
+        char request[96];
+        snprintf(request, sizeof(request), "{\"jsonrpc\":\"2.0\",\"method\":\"%s\",\"id\":1}", names[n]);
+        int64_t start = esp_timer_get_time();
+        for (size_t i = 0; i < rounds; ++i) {
+            free(json_rpc_server_handle_request(server, NULL, request));
+        }
+        int64_t end = esp_timer_get_time();
+        volatile size_t found = 0;
+        for (size_t i = 0; i < rounds; ++i) {
+            const json_rpc_config_t *c = cfg;
+            while (c->method && strcmp(c->method, names[n])) {
+                c++;
+            }
+            found += c->method != NULL;
+        }
+        int64_t scan = esp_timer_get_time();
+        printf("lookup %-18s %9.0f req/s of %d methods, linear scan %6.1f ns\n", names[n], rounds * 1e6 / (end - start + 1),
+            RPC_METHODS_GENERATED, (scan - end) * 1e3 / rounds);
+    }
+}
+
+static int compare(const void *a, const void *b) {
+    return strcmp(*(const char **)a, *(const char **)b);
+}
@@ -0,0 +1,30 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rpc_methods.h"
+
+// libFuzzer entry points, every input goes through both the JSON and the
+// CBOR entry point of the dashboard methods
+
+/***************************
+***** PUBLIC FUNCTIONS *****
+***************************/
+
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+    rpc_methods_init();
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    char *request = malloc(size + 1);
+    size_t response_len;
+    if (!request) {
+        return 0;
+    }
+    memcpy(request, data, size);
+    request[size] = '\0';
+    free(json_rpc_handle_request(NULL, request));
+    free(request);
+    free(json_rpc_handle_request_cbor(NULL, data, size, &response_len));
+    return 0;
+}
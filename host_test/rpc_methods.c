@@ -0,0 +1,291 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "message.h"
+#include "rpc_methods.h"
+
+/***************************
+***** CONSTANTS ************
+***************************/
+
+#define MAX_NETWORKS    16
+#define MAX_SSID        33
+#define MAX_PASSWORD    65
+#define MAX_PATH        128
+#define FILES           32
+#define SCAN_RESULTS    12
+#define ERROR_BUSY      1
+#define MAX_NAME        32
+
+/***************************
+***** MACROS ***************
+***************************/
+
+/***************************
+***** TYPES ****************
+***************************/
+
+typedef struct {
+    char ssid[MAX_SSID];
+    char password[MAX_PASSWORD];
+} network_t;
+
+typedef struct {
+    size_t    cnt;
+    network_t network[MAX_NETWORKS];
+} wifi_cfg_t;
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static void get_info(void *ctx, void *params, void **result);
+static uint8_t info_builder(void *result, cJSON **json);
+static void *path_parser(cJSON *params);
+static void get_files(void *ctx, void *params, void **result);
+static uint8_t files_writer(void *result, json_rpc_writer_t *w);
+static void *wifi_cfg_parser(cJSON *params);
+static bool network_parse(cJSON *json, network_t *network);
+static void set_wifi_cfg(void *ctx, void *params, void **result);
+static uint8_t true_builder(void *result, cJSON **json);
+static void get_wifi_cfg(void *ctx, void *params, void **result);
+static uint8_t wifi_cfg_builder(void *result, cJSON **json);
+static void scan(void *ctx, void *params, json_rpc_token_t *token);
+static uint8_t scan_writer(void *result, json_rpc_writer_t *w);
+static void format(void *ctx, void *params, void **result);
+static uint8_t busy_builder(void *result, cJSON **json);
+static void send(void *ctx, char *response, size_t len, bool binary);
+static void generated(void *ctx, void *params, void **result);
+static uint8_t null_writer(void *result, json_rpc_writer_t *w);
+
+/***************************
+***** LOCAL VARIABLES ******
+***************************/
+
+static const json_rpc_config_t methods[] = {
+    { .method = "get-info",        .handler = get_info,      .result_builder = info_builder, .cache = true },
+    { .method = "get-files",       .handler = get_files,     .param_parser = path_parser, .result_writer = files_writer },
+    { .method = "set-wifi-config", .handler = set_wifi_cfg,  .param_parser = wifi_cfg_parser, .result_builder = true_builder, .arena = true },
+    { .method = "get-wifi-config", .handler = get_wifi_cfg,  .result_builder = wifi_cfg_builder, .cache = true, .arena = true },
+    { .method = "scan",            .async_handler = scan,    .result_writer = scan_writer },
+    { .method = "format",          .handler = format,        .result_builder = busy_builder },
+    { 0 }
+};
+
+static const json_rpc_error_config_t errors[] = {
+    { ERROR_BUSY, "busy" },
+    { 0 }
+};
+
+static const char *verbs[] = { "get", "set", "reset", "list", "start", "stop", "read", "write", "enable", "disable" };
+static const char *nouns[] = { "volume", "station", "playlist", "equalizer", "led", "button", "sntp", "ota", "storage", "display" };
+
+_Static_assert(sizeof(verbs) / sizeof(verbs[0]) * sizeof(nouns) / sizeof(nouns[0]) == RPC_METHODS_GENERATED, "one method per verb and noun");
+
+static json_rpc_config_t generated_cfg[RPC_METHODS_GENERATED + 1];
+static char generated_names[RPC_METHODS_GENERATED][MAX_NAME];
+static json_rpc_server_t *generated_server;
+static msg_type_t wifi_changed;
+static wifi_cfg_t wifi_cfg;
+static atomic_size_t sent;
+
+/***************************
+***** PUBLIC FUNCTIONS *****
+***************************/
+
+void rpc_methods_init(void) {
+    msg_init();
+    wifi_changed = msg_register();
+    json_rpc_init(methods, errors);
+    json_rpc_set_sender(send);
+    json_rpc_invalidate_on("get-wifi-config", wifi_changed);
+    json_rpc_invalidate_on("get-info", wifi_changed);
+}
+
+size_t rpc_methods_sent(void) {
+    return atomic_load(&sent);
+}
+
+// servers are never destroyed, so there is only one of these
+json_rpc_server_t *rpc_methods_generated(const json_rpc_config_t **cfg) {
+    size_t n = 0;
+    *cfg = generated_cfg;
+    if (generated_server) {
+        return generated_server;
+    }
+    for (size_t v = 0; v < sizeof(verbs) / sizeof(verbs[0]); ++v) {
+        for (size_t i = 0; i < sizeof(nouns) / sizeof(nouns[0]); ++i, ++n) {
+            snprintf(generated_names[n], MAX_NAME, "%s-%s", verbs[v], nouns[i]);
+            generated_cfg[n] = (json_rpc_config_t){
+                .method = generated_names[n],
+                .handler = generated,
+                .result_writer = null_writer
+            };
+        }
+    }
+    generated_server = json_rpc_server_create(generated_cfg, errors);
+    return generated_server;
+}
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static void get_info(void *ctx, void *params, void **result) {
+    *result = NULL;
+}
+
+static uint8_t info_builder(void *result, cJSON **json) {
+    *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(*json, "version", "1.4.2");
+    cJSON_AddStringToObject(*json, "idf", "v5.4");
+    cJSON_AddNumberToObject(*json, "uptime", 86400);
+    cJSON_AddNumberToObject(*json, "heap", 145320);
+    cJSON_AddNumberToObject(*json, "heap-min", 98211);
+    cJSON_AddNumberToObject(*json, "rssi", -61);
+    cJSON_AddItemToObject(*json, "sta", cJSON_CreateBool(true));
+    cJSON_AddItemToObject(*json, "ap", cJSON_CreateBool(false));
+    return 0;
+}
+
+static void *path_parser(cJSON *params) {
+    cJSON *path = cJSON_GetObjectItemCaseSensitive(params, "path");
+    if (!cJSON_IsString(path) || strlen(path->valuestring) >= MAX_PATH) {
+        return NULL;
+    }
+    char *copy = malloc(MAX_PATH);
+    if (copy) {
+        strcpy(copy, path->valuestring);
+    }
+    return copy;
+}
+
+static void get_files(void *ctx, void *params, void **result) {
+    *result = params;
+}
+
+static uint8_t files_writer(void *result, json_rpc_writer_t *w) {
+    char name[MAX_PATH + 16];
+    json_rpc_write_array(w);
+    for (int i = 0; i < FILES; ++i) {
+        snprintf(name, sizeof(name), "%s/file%02d.txt", (char *)result, i);
+        json_rpc_write_object(w);
+        json_rpc_write_key(w, "name");
+        json_rpc_write_string(w, name);
+        json_rpc_write_key(w, "size");
+        json_rpc_write_int(w, 1024 * i + 17);
+        json_rpc_write_key(w, "dir");
+        json_rpc_write_bool(w, i % 8 == 0);
+        json_rpc_write_end(w);
+    }
+    json_rpc_write_end(w);
+    free(result);
+    return 0;
+}
+
+// {"networks":[{"ssid":"...","password":"..."},...]}, the strings are copied
+// out of the tree since it lives in the request arena
+static void *wifi_cfg_parser(cJSON *params) {
+    cJSON *networks = cJSON_GetObjectItemCaseSensitive(params, "networks");
+    cJSON *network;
+    if (!cJSON_IsArray(networks) || cJSON_GetArraySize(networks) > MAX_NETWORKS) {
+        return NULL;
+    }
+    wifi_cfg_t *cfg = calloc(1, sizeof(wifi_cfg_t));
+    if (!cfg) {
+        return NULL;
+    }
+    cJSON_ArrayForEach(network, networks) {
+        if (!network_parse(network, &cfg->network[cfg->cnt++])) {
+            free(cfg);
+            return NULL;
+        }
+    }
+    return cfg;
+}
+
+static bool network_parse(cJSON *json, network_t *network) {
+    cJSON *ssid = cJSON_GetObjectItemCaseSensitive(json, "ssid");
+    cJSON *password = cJSON_GetObjectItemCaseSensitive(json, "password");
+    if (!cJSON_IsString(ssid) || !cJSON_IsString(password) || strlen(ssid->valuestring) >= MAX_SSID || strlen(password->valuestring) >= MAX_PASSWORD) {
+        return false;
+    }
+    strcpy(network->ssid, ssid->valuestring);
+    strcpy(network->password, password->valuestring);
+    return true;
+}
+
+static void set_wifi_cfg(void *ctx, void *params, void **result) {
+    wifi_cfg = *(wifi_cfg_t *)params;
+    free(params);
+    msg_send_value(wifi_changed, 0);
+    *result = NULL;
+}
+
+static uint8_t true_builder(void *result, cJSON **json) {
+    *json = cJSON_CreateBool(true);
+    return 0;
+}
+
+static void get_wifi_cfg(void *ctx, void *params, void **result) {
+    *result = &wifi_cfg;
+}
+
+// the passwords stay on the device
+static uint8_t wifi_cfg_builder(void *result, cJSON **json) {
+    wifi_cfg_t *cfg = result;
+    cJSON *networks = cJSON_CreateArray();
+    for (size_t i = 0; i < cfg->cnt; ++i) {
+        cJSON *network = cJSON_CreateObject();
+        cJSON_AddStringToObject(network, "ssid", cfg->network[i].ssid);
+        cJSON_AddItemToArray(networks, network);
+    }
+    *json = cJSON_CreateObject();
+    cJSON_AddItemToObject(*json, "networks", networks);
+    return 0;
+}
+
+// a scan finishes right away here, on the device it completes from the wlan task
+static void scan(void *ctx, void *params, json_rpc_token_t *token) {
+    json_rpc_complete(token, NULL);
+}
+
+static uint8_t scan_writer(void *result, json_rpc_writer_t *w) {
+    char ssid[MAX_SSID];
+    json_rpc_write_array(w);
+    for (int i = 0; i < SCAN_RESULTS; ++i) {
+        snprintf(ssid, sizeof(ssid), "network-%d", i);
+        json_rpc_write_object(w);
+        json_rpc_write_key(w, "ssid");
+        json_rpc_write_string(w, ssid);
+        json_rpc_write_key(w, "rssi");
+        json_rpc_write_int(w, -40 - 3 * i);
+        json_rpc_write_end(w);
+    }
+    json_rpc_write_end(w);
+    return 0;
+}
+
+static void format(void *ctx, void *params, void **result) {
+    *result = NULL;
+}
+
+static uint8_t busy_builder(void *result, cJSON **json) {
+    return ERROR_BUSY;
+}
+
+static void send(void *ctx, char *response, size_t len, bool binary) {
+    atomic_fetch_add(&sent, 1);
+    free(response);
+}
+
+static void generated(void *ctx, void *params, void **result) {
+    *result = NULL;
+}
+
+static uint8_t null_writer(void *result, json_rpc_writer_t *w) {
+    json_rpc_write_null(w);
+    return 0;
+}
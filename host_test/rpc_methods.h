@@ -0,0 +1,24 @@
+#pragma once
+
+#include "json_rpc.h"
+
+// methods shaped like the ones the web dashboard calls, shared by the
+// benchmark and the fuzz target
+
+/********************
+***** CONSTANTS *****
+********************/
+
+#define RPC_METHODS_GENERATED 100
+
+/********************
+***** FUNCTIONS *****
+********************/
+
+// sets up the message bus and the default server
+void   rpc_methods_init(void);
+// responses of async calls handed to the sender so far
+size_t rpc_methods_sent(void);
+// a server with RPC_METHODS_GENERATED methods named verb-noun that answer
+// null, cfg is set to their table in the order the names were generated
+json_rpc_server_t *rpc_methods_generated(const json_rpc_config_t **cfg);
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cbor.h"
+#include "tokenizer.h"
+
+// accept and reject tables for the JSON tokenizer and the CBOR decoder, the
+// two parsers that see untrusted input before anything else does; a whole
+// request is accepted the way the server does it, one value and nothing after
+
+/***************************
+***** CONSTANTS ************
+***************************/
+
+#define TOK_MAX_DEPTH   64
+#define CBOR_MAX_DEPTH  32
+#define MAX_HEX         64
+
+/***************************
+***** MACROS ***************
+***************************/
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+/***************************
+***** TYPES ****************
+***************************/
+
+typedef struct {
+    const char *json;
+    bool       accept;
+} json_case_t;
+
+// expect is the unescaped string, NULL if tok_string has to refuse it
+typedef struct {
+    const char *json;
+    const char *expect;
+} string_case_t;
+
+typedef struct {
+    const char *hex;
+    bool       accept;
+} cbor_case_t;
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static bool json_accepts(const char *json);
+static bool cbor_accepts(const uint8_t *data, size_t len);
+static size_t unhex(const char *hex, uint8_t *out);
+static void json_nesting(void);
+static void cbor_nesting(void);
+static void check(bool ok, const char *what, const char *input);
+
+/***************************
+***** LOCAL VARIABLES ******
+***************************/
+
+static const json_case_t json_cases[] = {
+    { "{}", true },
+    { "[]", true },
+    { "\"a\"", true },
+    { "0", true },
+    { "-0.5e+3", true },
+    { "1E9", true },
+    { "true", true },
+    { "null", true },
+    { " {\"a\" : [1, 2, {\"b\": null}], \"c\": \"\\\"\\\\\\/\\b\\f\\n\\r\\t\\u00e9\"} ", true },
+    // structure
+    { "", false },
+    { "{", false },
+    { "[1,]", false },
+    { "[,1]", false },
+    { "{\"a\":1,}", false },
+    { "{\"a\"}", false },
+    { "{\"a\" 1}", false },
+    { "{1:2}", false },
+    { "{\"a\":1 \"b\":2}", false },
+    { "[1 2]", false },
+    { "]", false },
+    // numbers and literals
+    { "01", false },
+    { "1.", false },
+    { ".5", false },
+    { "-", false },
+    { "+1", false },
+    { "1e", false },
+    { "1e+", false },
+    { "0x10", false },
+    { "tru", false },
+    { "nul", false },
+    { "True", false },
+    // strings and escapes
+    { "\"abc", false },
+    { "\"a\x01\"", false },
+    { "\"a\nb\"", false },
+    { "\"\\q\"", false },
+    { "\"\\u12G4\"", false },
+    { "\"\\u12\"", false },
+    { "\"\\", false },
+    { "'a'", false },
+    // trailing data
+    { "{} ", true },
+    { "{} x", false },
+    { "{}{}", false },
+    { "1 2", false },
+    { "\"a\",", false },
+};
+
+static const string_case_t string_cases[] = {
+    { "\"\"", "" },
+    { "\"plain\"", "plain" },
+    { "\"a\\nb\\tc\"", "a\nb\tc" },
+    { "\"\\\"\\\\\\/\"", "\"\\/" },
+    { "\"\\u0041\"", "A" },
+    { "\"\\u00e9\"", "\xc3\xa9" },
+    { "\"\\u20AC\"", "\xe2\x82\xac" },
+    { "\"\\ud83d\\ude00\"", "\xf0\x9f\x98\x80" },
+    { "\"\\uD83D\\uDE00\"", "\xf0\x9f\x98\x80" },
+    { "\"\\u0000\"", NULL },
+    { "\"a\\u0000b\"", NULL },
+    { "\"\\ud83d\"", NULL },
+    { "\"\\ude00\"", NULL },
+    { "\"\\ud83d\\u0041\"", NULL },
+    { "\"\\ud83dx\"", NULL },
+};
+
+static const cbor_case_t cbor_cases[] = {
+    { "00", true },
+    { "17", true },
+    { "1818", true },
+    { "190100", true },
+    { "1a00010000", true },
+    { "1b0000000100000000", true },
+    { "20", true },
+    { "3bffffffffffffffff", true },
+    { "60", true },
+    { "63616263", true },
+    { "4401020304", true },
+    { "80", true },
+    { "83010203", true },
+    { "a0", true },
+    { "a2616101616202", true },
+    { "c11a514b67b0", true },
+    { "f4", true },
+    { "f6", true },
+    { "f93c00", true },
+    { "fa47c35000", true },
+    { "fb3ff199999999999a", true },
+    // truncated heads and bodies
+    { "", false },
+    { "18", false },
+    { "1901", false },
+    { "1a000000", false },
+    { "1b00000000000000", false },
+    { "6261", false },
+    { "5b00000000000000ff41", false },
+    { "7bffffffffffffffff", false },
+    { "81", false },
+    { "9bffffffffffffffff00", false },
+    { "c1", false },
+    { "f9", false },
+    { "fb000000", false },
+    // reserved and misplaced additional information
+    { "1c", false },
+    { "1d", false },
+    { "1e", false },
+    { "1f", false },
+    { "3f", false },
+    { "df00", false },
+    { "ff", false },
+    // indefinite length
+    { "5f4201024103ff", true },
+    { "5fff", true },
+    { "7f616161626163ff", true },
+    { "9f0102ff", true },
+    { "9fff", true },
+    { "bf616101ff", true },
+    { "9f9f00ffff", true },
+    { "5f", false },
+    { "5f4201", false },
+    { "5f6161ff", false },
+    { "5f5fffff", false },
+    { "5f00ff", false },
+    { "7f4161ff", false },
+    { "9f0102", false },
+    { "bf6161", false },
+    // odd-length maps
+    { "a1", false },
+    { "a16161", false },
+    { "a201026161", false },
+    { "bf6161ff", false },
+    { "bf6161016162ff", false },
+    // trailing data
+    { "0000", false },
+    { "a0a0", false },
+    { "80ff", false },
+};
+
+static int failures;
+
+/***************************
+***** PUBLIC FUNCTIONS *****
+***************************/
+
+int main(void) {
+    char buf[32];
+    uint8_t data[MAX_HEX];
+
+    for (size_t i = 0; i < COUNT(json_cases); ++i) {
+        check(json_accepts(json_cases[i].json) == json_cases[i].accept, json_cases[i].accept ? "json accept" : "json reject", json_cases[i].json);
+    }
+    json_nesting();
+
+    for (size_t i = 0; i < COUNT(string_cases); ++i) {
+        const char *pos = string_cases[i].json;
+        const char *expect = string_cases[i].expect;
+        tok_t tok;
+        bool ok = tok_value(&pos, &tok) && tok.type == TOK_STRING;
+        size_t len = ok ? tok_string(&tok, buf, sizeof(buf)) : 0;
+        check(ok && (expect ? len < sizeof(buf) && !strcmp(buf, expect) : len == sizeof(buf)), "json string", string_cases[i].json);
+    }
+    // a string that does not fit is refused like an invalid one
+    const char *pos = "\"0123456789abcdef0123456789abcdef\"";
+    tok_t tok;
+    check(tok_value(&pos, &tok) && tok_string(&tok, buf, sizeof(buf)) == sizeof(buf), "json string too long", tok.start);
+
+    for (size_t i = 0; i < COUNT(cbor_cases); ++i) {
+        size_t len = unhex(cbor_cases[i].hex, data);
+        check(cbor_accepts(data, len) == cbor_cases[i].accept, cbor_cases[i].accept ? "cbor accept" : "cbor reject", cbor_cases[i].hex);
+    }
+    cbor_nesting();
+
+    // text with an embedded NUL must not pass for the text before it
+    static const struct {
+        const char *hex;
+        const char *expect;
+    } cbor_strings[] = {
+        { "686765742d696e666f", "get-info" },
+        { "7f6467657420646c697374ff", "get list" },
+        { "6a6765742d696e666f0078", NULL },
+        { "7f63676574620078ff", NULL },
+    };
+    for (size_t i = 0; i < COUNT(cbor_strings); ++i) {
+        size_t len = unhex(cbor_strings[i].hex, data);
+        const uint8_t *p = data;
+        cbor_t item;
+        bool ok = cbor_item(&p, data + len, &item);
+        size_t n = ok ? cbor_string(&item, buf, sizeof(buf)) : 0;
+        const char *expect = cbor_strings[i].expect;
+        check(ok && (expect ? n < sizeof(buf) && !strcmp(buf, expect) : n == sizeof(buf)), "cbor string", cbor_strings[i].hex);
+    }
+
+    printf("%zu json, %zu string and %zu cbor cases, %d failed\n", COUNT(json_cases), COUNT(string_cases), COUNT(cbor_cases), failures);
+    return failures != 0;
+}
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static bool json_accepts(const char *json) {
+    const char *pos = json;
+    tok_t tok;
+    return tok_value(&pos, &tok) && tok_end(pos);
+}
+
+static bool cbor_accepts(const uint8_t *data, size_t len) {
+    const uint8_t *pos = data;
+    cbor_t item;
+    return cbor_item(&pos, data + len, &item) && pos == data + len;
+}
+
+static size_t unhex(const char *hex, uint8_t *out) {
+    size_t len = strlen(hex) / 2;
+    for (size_t i = 0; i < len && i < MAX_HEX; ++i) {
+        sscanf(hex + 2 * i, "%2hhx", &out[i]);
+    }
+    return len < MAX_HEX ? len : MAX_HEX;
+}
+
+// the limit itself is accepted, one level more is not
+static void json_nesting(void) {
+    char json[2 * (TOK_MAX_DEPTH + 1) + 1];
+    for (int depth = TOK_MAX_DEPTH; depth <= TOK_MAX_DEPTH + 1; ++depth) {
+        memset(json, '[', depth);
+        memset(json + depth, ']', depth);
+        json[2 * depth] = '\0';
+        check(json_accepts(json) == (depth == TOK_MAX_DEPTH), "json nesting", json);
+    }
+    // objects count the same as arrays
+    char obj[6 * (TOK_MAX_DEPTH + 1) + 2];
+    for (int depth = TOK_MAX_DEPTH; depth <= TOK_MAX_DEPTH + 1; ++depth) {
+        char *p = obj;
+        for (int i = 0; i < depth; ++i) {
+            p += sprintf(p, "{\"a\":");
+        }
+        *p++ = '1';
+        memset(p, '}', depth);
+        p[depth] = '\0';
+        check(json_accepts(obj) == (depth == TOK_MAX_DEPTH), "json object nesting", obj);
+    }
+}
+
+// arrays nested to the limit hold an item one level deeper, which is refused
+static void cbor_nesting(void) {
+    uint8_t data[CBOR_MAX_DEPTH + 1];
+    for (int depth = CBOR_MAX_DEPTH - 1; depth <= CBOR_MAX_DEPTH; ++depth) {
+        memset(data, 0x81, depth);
+        data[depth] = 0x00;
+        check(cbor_accepts(data, depth + 1) == (depth < CBOR_MAX_DEPTH), "cbor nesting", depth < CBOR_MAX_DEPTH ? "below the limit" : "at the limit");
+    }
+}
+
+static void check(bool ok, const char *what, const char *input) {
+    if (!ok) {
+        printf("FAIL %s: %s\n", what, input);
+        failures++;
+    }
+}
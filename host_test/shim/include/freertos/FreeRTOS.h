@@ -0,0 +1,74 @@
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+// just enough FreeRTOS on top of pthreads to run the components on a Linux
+// host, every task is a thread and one tick is one millisecond
+
+/********************
+***** CONSTANTS *****
+********************/
+
+#define pdFALSE             0
+#define pdTRUE              1
+#define pdFAIL              pdFALSE
+#define pdPASS              pdTRUE
+
+#define portMAX_DELAY       0xFFFFFFFFu
+#define portTICK_PERIOD_MS  1
+#define portNUM_PROCESSORS  2
+
+#define tskNO_AFFINITY      -1
+
+#define configTASK_NOTIFICATION_ARRAY_ENTRIES CONFIG_FREERTOS_TASK_NOTIFICATION_ARRAY_ENTRIES
+
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+
+/********************
+***** MACROS ********
+********************/
+
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+// every critical section takes the same recursive lock
+#define portMUX_INITIALIZE(mux)      ((void)(mux))
+#define portENTER_CRITICAL(mux)      ((void)(mux), shim_critical(true))
+#define portEXIT_CRITICAL(mux)       ((void)(mux), shim_critical(false))
+#define portENTER_CRITICAL_SAFE(mux) ((void)(mux), shim_critical(true))
+#define portEXIT_CRITICAL_SAFE(mux)  ((void)(mux), shim_critical(false))
+#define portYIELD_FROM_ISR(woken)    ((void)(woken))
+
+/********************
+***** TYPES *********
+********************/
+
+typedef int          BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t     TickType_t;
+typedef uint8_t      StackType_t;
+
+typedef struct shim_task  *TaskHandle_t;
+typedef struct shim_queue *QueueHandle_t;
+
+typedef struct {
+    int unused;
+} portMUX_TYPE;
+
+typedef struct {
+    int unused;
+} StaticTask_t;
+
+typedef struct {
+    int unused;
+} StaticQueue_t;
+
+/********************
+***** FUNCTIONS *****
+********************/
+
+void shim_critical(bool enter);
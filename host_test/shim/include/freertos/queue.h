@@ -0,0 +1,14 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+/********************
+***** FUNCTIONS *****
+********************/
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t *storage, StaticQueue_t *queue_buf);
+BaseType_t    xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t    xQueueSendToBackFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken);
+BaseType_t    xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+void          vQueueDelete(QueueHandle_t queue);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+/********************
+***** MACROS ********
+********************/
+
+#define xTaskNotifyGive(task)                   xTaskNotifyGiveIndexed(task, 0)
+#define vTaskNotifyGiveFromISR(task, woken)     vTaskNotifyGiveIndexedFromISR(task, 0, woken)
+#define ulTaskNotifyTake(clear, ticks)          ulTaskNotifyTakeIndexed(0, clear, ticks)
+
+/********************
+***** TYPES *********
+********************/
+
+typedef void (*TaskFunction_t)(void *param);
+
+typedef struct {
+    TickType_t entered;
+} TimeOut_t;
+
+/********************
+***** FUNCTIONS *****
+********************/
+
+BaseType_t   xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *param, UBaseType_t prio, TaskHandle_t *task, BaseType_t core);
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *param, UBaseType_t prio, StackType_t *stack_buf, StaticTask_t *task_buf, BaseType_t core);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+TickType_t   xTaskGetTickCount(void);
+void         vTaskDelay(TickType_t ticks);
+BaseType_t   xTaskNotifyGiveIndexed(TaskHandle_t task, UBaseType_t index);
+void         vTaskNotifyGiveIndexedFromISR(TaskHandle_t task, UBaseType_t index, BaseType_t *woken);
+uint32_t     ulTaskNotifyTakeIndexed(UBaseType_t index, BaseType_t clear, TickType_t ticks);
+void         vTaskSetTimeOutState(TimeOut_t *timeout);
+BaseType_t   xTaskCheckForTimeOut(TimeOut_t *timeout, TickType_t *ticks);
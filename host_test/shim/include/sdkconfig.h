@@ -0,0 +1,43 @@
+#pragma once
+
+// the defaults of the Kconfig options, any of them can be overridden with -D
+
+#ifndef CONFIG_MSG_MAX_TYPES
+#define CONFIG_MSG_MAX_TYPES            128
+#endif
+#ifndef CONFIG_MSG_MAX_HANDLES
+#define CONFIG_MSG_MAX_HANDLES          20
+#endif
+#ifndef CONFIG_MSG_QUEUE_LENGTH
+#define CONFIG_MSG_QUEUE_LENGTH         32
+#endif
+#ifndef CONFIG_MSG_URGENT_LENGTH
+#define CONFIG_MSG_URGENT_LENGTH        8
+#endif
+#ifndef CONFIG_MSG_MAX_SUBSCRIPTIONS
+#define CONFIG_MSG_MAX_SUBSCRIPTIONS    40
+#endif
+#ifndef CONFIG_MSG_DISPATCH_STACK_SIZE
+#define CONFIG_MSG_DISPATCH_STACK_SIZE  4096
+#endif
+#ifndef CONFIG_MSG_NOTIFY_INDEX
+#define CONFIG_MSG_NOTIFY_INDEX         1
+#endif
+#ifndef CONFIG_MSG_STATS
+#define CONFIG_MSG_STATS                1
+#endif
+#ifndef CONFIG_MSG_POOL_SMALL_BLOCKS
+#define CONFIG_MSG_POOL_SMALL_BLOCKS    16
+#endif
+#ifndef CONFIG_MSG_POOL_MEDIUM_BLOCKS
+#define CONFIG_MSG_POOL_MEDIUM_BLOCKS   8
+#endif
+#ifndef CONFIG_MSG_POOL_LARGE_BLOCKS
+#define CONFIG_MSG_POOL_LARGE_BLOCKS    4
+#endif
+#ifndef CONFIG_JSON_RPC_ARENA_SIZE
+#define CONFIG_JSON_RPC_ARENA_SIZE      4096
+#endif
+#ifndef CONFIG_FREERTOS_TASK_NOTIFICATION_ARRAY_ENTRIES
+#define CONFIG_FREERTOS_TASK_NOTIFICATION_ARRAY_ENTRIES 2
+#endif
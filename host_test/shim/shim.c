@@ -0,0 +1,384 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+/***************************
+***** CONSTANTS ************
+***************************/
+
+/***************************
+***** MACROS ***************
+***************************/
+
+/***************************
+***** TYPES ****************
+***************************/
+
+// every handle stays on the list until its thread exits, so the leak
+// checker finds the one of the main thread
+struct shim_task {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify[configTASK_NOTIFICATION_ARRAY_ENTRIES];
+    struct shim_task *prev;
+    struct shim_task *next;
+};
+
+struct shim_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t *items;
+};
+
+typedef struct {
+    TaskFunction_t fn;
+    void *param;
+} start_t;
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static void shim_init(void);
+static void shim_task_free(void *ptr);
+static void *shim_task_start(void *ptr);
+static void shim_cond_init(pthread_cond_t *cond);
+static void shim_deadline(struct timespec *ts, TickType_t ticks);
+static bool shim_wait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks, const struct timespec *deadline);
+static QueueHandle_t shim_queue_create(UBaseType_t length, UBaseType_t item_size, UBaseType_t count);
+
+/***************************
+***** LOCAL VARIABLES ******
+***************************/
+
+static pthread_mutex_t critical = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t task_key;
+static struct shim_task *tasks;
+static struct timespec start;
+
+/***************************
+***** PUBLIC FUNCTIONS *****
+***************************/
+
+void shim_critical(bool enter) {
+    if (enter) {
+        pthread_mutex_lock(&critical);
+    } else {
+        pthread_mutex_unlock(&critical);
+    }
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *param, UBaseType_t prio, TaskHandle_t *task, BaseType_t core) {
+    start_t *st = malloc(sizeof(start_t));
+    pthread_t thread;
+    if (!st) {
+        return pdFAIL;
+    }
+    st->fn = fn;
+    st->param = param;
+    if (pthread_create(&thread, NULL, shim_task_start, st)) {
+        free(st);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if (task) {
+        // the handle only exists once the thread asks for it
+        *task = NULL;
+    }
+    return pdPASS;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *param, UBaseType_t prio, StackType_t *stack_buf, StaticTask_t *task_buf, BaseType_t core) {
+    xTaskCreatePinnedToCore(fn, name, stack, param, prio, NULL, core);
+    return NULL;
+}
+
+// threads that were not started as tasks get a handle on first use
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    pthread_once(&once, shim_init);
+    TaskHandle_t task = pthread_getspecific(task_key);
+    if (!task) {
+        task = calloc(1, sizeof(struct shim_task));
+        assert(task);
+        pthread_mutex_init(&task->lock, NULL);
+        shim_cond_init(&task->cond);
+        pthread_setspecific(task_key, task);
+        shim_critical(true);
+        task->next = tasks;
+        if (tasks) {
+            tasks->prev = task;
+        }
+        tasks = task;
+        shim_critical(false);
+    }
+    return task;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return esp_timer_get_time() / 1000;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    struct timespec ts = {
+        .tv_sec = ticks / 1000,
+        .tv_nsec = (ticks % 1000) * 1000000L
+    };
+    while (nanosleep(&ts, &ts) && errno == EINTR) {
+    }
+}
+
+BaseType_t xTaskNotifyGiveIndexed(TaskHandle_t task, UBaseType_t index) {
+    assert(index < configTASK_NOTIFICATION_ARRAY_ENTRIES);
+    pthread_mutex_lock(&task->lock);
+    task->notify[index]++;
+    pthread_cond_broadcast(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveIndexedFromISR(TaskHandle_t task, UBaseType_t index, BaseType_t *woken) {
+    xTaskNotifyGiveIndexed(task, index);
+    if (woken) {
+        *woken = pdTRUE;
+    }
+}
+
+uint32_t ulTaskNotifyTakeIndexed(UBaseType_t index, BaseType_t clear, TickType_t ticks) {
+    assert(index < configTASK_NOTIFICATION_ARRAY_ENTRIES);
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline;
+    shim_deadline(&deadline, ticks);
+    pthread_mutex_lock(&task->lock);
+    while (!task->notify[index] && shim_wait(&task->cond, &task->lock, ticks, &deadline)) {
+    }
+    uint32_t notify = task->notify[index];
+    if (notify) {
+        task->notify[index] = clear ? 0 : notify - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return notify;
+}
+
+void vTaskSetTimeOutState(TimeOut_t *timeout) {
+    timeout->entered = xTaskGetTickCount();
+}
+
+BaseType_t xTaskCheckForTimeOut(TimeOut_t *timeout, TickType_t *ticks) {
+    if (*ticks == portMAX_DELAY) {
+        return pdFALSE;
+    }
+    TickType_t now = xTaskGetTickCount();
+    TickType_t elapsed = now - timeout->entered;
+    if (elapsed >= *ticks) {
+        *ticks = 0;
+        return pdTRUE;
+    }
+    *ticks -= elapsed;
+    timeout->entered = now;
+    return pdFALSE;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    return shim_queue_create(length, item_size, 0);
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t *storage, StaticQueue_t *queue_buf) {
+    return shim_queue_create(length, item_size, 0);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    struct timespec deadline;
+    shim_deadline(&deadline, ticks);
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length && shim_wait(&queue->cond, &queue->lock, ticks, &deadline)) {
+    }
+    bool sent = queue->count < queue->length;
+    if (sent && queue->item_size) {
+        memcpy(queue->items + (queue->head + queue->count) % queue->length * queue->item_size, item, queue->item_size);
+    }
+    if (sent) {
+        queue->count++;
+        pthread_cond_broadcast(&queue->cond);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return sent ? pdPASS : pdFAIL;
+}
+
+BaseType_t xQueueSendToBackFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken) {
+    BaseType_t sent = xQueueSendToBack(queue, item, 0);
+    if (sent && woken) {
+        *woken = pdTRUE;
+    }
+    return sent;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+    struct timespec deadline;
+    shim_deadline(&deadline, ticks);
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->count && shim_wait(&queue->cond, &queue->lock, ticks, &deadline)) {
+    }
+    bool received = queue->count;
+    if (received && queue->item_size) {
+        memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    }
+    if (received) {
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_broadcast(&queue->cond);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return received ? pdPASS : pdFAIL;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->items);
+    free(queue);
+}
+
+// no priority inheritance and no recursion, which the components don't need
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return shim_queue_create(1, 0, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *sem_buf) {
+    return xSemaphoreCreateMutex();
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+    return shim_queue_create(max, 0, initial);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCountingStatic(UBaseType_t max, UBaseType_t initial, StaticSemaphore_t *sem_buf) {
+    return xSemaphoreCreateCounting(max, initial);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    return xQueueReceive(sem, NULL, ticks);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    return xQueueSendToBack(sem, NULL, 0);
+}
+
+int64_t esp_timer_get_time(void) {
+    pthread_once(&once, shim_init);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1000000LL + (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+    return malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+    return calloc(n, size);
+}
+
+void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps) {
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void heap_caps_free(void *ptr) {
+    free(ptr);
+}
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static void shim_init(void) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_key_create(&task_key, shim_task_free);
+}
+
+static void shim_task_free(void *ptr) {
+    TaskHandle_t task = ptr;
+    shim_critical(true);
+    if (task->prev) {
+        task->prev->next = task->next;
+    } else {
+        tasks = task->next;
+    }
+    if (task->next) {
+        task->next->prev = task->prev;
+    }
+    shim_critical(false);
+    pthread_cond_destroy(&task->cond);
+    pthread_mutex_destroy(&task->lock);
+    free(task);
+}
+
+static void *shim_task_start(void *ptr) {
+    start_t st = *(start_t *)ptr;
+    free(ptr);
+    st.fn(st.param);
+    return NULL;
+}
+
+static void shim_cond_init(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static void shim_deadline(struct timespec *ts, TickType_t ticks) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    if (ticks != portMAX_DELAY) {
+        ts->tv_sec += ticks / 1000;
+        ts->tv_nsec += (ticks % 1000) * 1000000L;
+        if (ts->tv_nsec >= 1000000000L) {
+            ts->tv_sec++;
+            ts->tv_nsec -= 1000000000L;
+        }
+    }
+}
+
+// false once the deadline has passed, the caller checks its condition again either way
+static bool shim_wait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks, const struct timespec *deadline) {
+    if (ticks == portMAX_DELAY) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+static QueueHandle_t shim_queue_create(UBaseType_t length, UBaseType_t item_size, UBaseType_t count) {
+    QueueHandle_t queue = calloc(1, sizeof(struct shim_queue));
+    if (!queue) {
+        return NULL;
+    }
+    queue->items = malloc(length * item_size + 1);
+    if (!queue->items) {
+        free(queue);
+        return NULL;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    shim_cond_init(&queue->cond);
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->count = count;
+    return queue;
+}
@@ -42,7 +42,7 @@ static esp_err_t file_put_handler(httpd_req_t *req);
 static esp_err_t file_delete_handler(httpd_req_t *req);
 static esp_err_t websocket_connect_handler(httpd_req_t *req);
 static esp_err_t websocket_data_handler(httpd_req_t *req);
-static void free_ws_msg(void *ptr);
+static void send_ws(con_id_t con, httpd_ws_type_t type, const uint8_t *payload, size_t len);
 
 /***************************
 ***** LOCAL VARIABLES ******
@@ -172,22 +172,13 @@ void http_close(int sockfd) {
 }
 
 void http_send_ws_msg(con_id_t con, const char *text) {
-    assert(server);
     assert(text);
+    send_ws(con, HTTPD_WS_TYPE_TEXT, (const uint8_t*)text, strlen(text));
+}
 
-    int sockfd;
-    if (con_get_sock(con, &sockfd)) {
-        if (httpd_ws_get_fd_info(server, sockfd) != HTTPD_WS_CLIENT_WEBSOCKET) return;
-
-        httpd_ws_frame_t ws_pkt = {
-            .final = true,
-            .fragmented = false,
-            .type = HTTPD_WS_TYPE_TEXT,
-            .payload = (uint8_t*)text,
-            .len = strlen(text)
-        };
-        httpd_ws_send_data(server, sockfd, &ws_pkt);
-    }
+void http_send_ws_bin(con_id_t con, const uint8_t *data, size_t len) {
+    assert(data);
+    send_ws(con, HTTPD_WS_TYPE_BINARY, data, len);
 }
 
 /***************************
@@ -299,7 +290,6 @@ static esp_err_t websocket_connect_handler(httpd_req_t *req) {
 
 static esp_err_t websocket_data_handler(httpd_req_t *req) {
     httpd_ws_frame_t ws_pkt;
-    uint8_t *buf = NULL;
     memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
 
     esp_err_t ret = httpd_ws_recv_frame(req, &ws_pkt, 0);
@@ -308,29 +298,33 @@ static esp_err_t websocket_data_handler(httpd_req_t *req) {
         return ret;
     }
 
-    if (ws_pkt.type == HTTPD_WS_TYPE_TEXT) {
-        LOGI("received TEXT with len: %d", ws_pkt.len);
+    if (ws_pkt.type == HTTPD_WS_TYPE_TEXT || ws_pkt.type == HTTPD_WS_TYPE_BINARY) {
+        LOGI("received %s with len: %d", ws_pkt.type == HTTPD_WS_TYPE_TEXT ? "TEXT" : "BINARY", ws_pkt.len);
         if (ws_pkt.len) {
-            buf = calloc(1, ws_pkt.len + 1);
-            if (buf == NULL) {
-                LOGE("Failed to calloc memory for buf");
+            ws_msg_t *ws_msg = msg_alloc(sizeof(ws_msg_t) + ws_pkt.len + 1, NULL);
+            if (ws_msg == NULL) {
+                LOGE("Failed to alloc memory for ws_msg");
                 return ESP_ERR_NO_MEM;
             }
-            ws_pkt.payload = buf;
+            ws_msg->text = (char*)(ws_msg + 1);
+            ws_pkt.payload = (uint8_t*)ws_msg->text;
             ret = httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len);
             if (ret != ESP_OK) {
                 LOGE("httpd_ws_recv_frame failed with %d", ret);
-                free(buf);
+                msg_release(ws_msg);
                 return ret;
             }
+            ws_msg->text[ws_pkt.len] = 0;
+            ws_msg->len = ws_pkt.len;
+            ws_msg->binary = ws_pkt.type == HTTPD_WS_TYPE_BINARY;
 
             con_id_t con;
             if (con_get_con(httpd_req_to_sockfd(req), &con)) {
                 con_ping(con);
-                ws_msg_t *ws_msg = calloc(1, sizeof(ws_msg_t));
                 ws_msg->con = con;
-                ws_msg->text = (char*)buf;
-                msg_send_ptr(msg_type_ws_recv, ws_msg, &free_ws_msg);
+                msg_send_ptr(msg_type_ws_recv, ws_msg);
+            } else {
+                msg_release(ws_msg);
             }
         }
     } else if (ws_pkt.type == HTTPD_WS_TYPE_PING) {
@@ -358,7 +352,20 @@ static esp_err_t websocket_data_handler(httpd_req_t *req) {
     return ret;
 }
 
-static void free_ws_msg(void *ptr) {
-    ws_msg_t *ws_msg = ptr;
-    free(ws_msg->text);
+static void send_ws(con_id_t con, httpd_ws_type_t type, const uint8_t *payload, size_t len) {
+    assert(server);
+
+    int sockfd;
+    if (con_get_sock(con, &sockfd)) {
+        if (httpd_ws_get_fd_info(server, sockfd) != HTTPD_WS_CLIENT_WEBSOCKET) return;
+
+        httpd_ws_frame_t ws_pkt = {
+            .final = true,
+            .fragmented = false,
+            .type = type,
+            .payload = (uint8_t*)payload,
+            .len = len
+        };
+        httpd_ws_send_data(server, sockfd, &ws_pkt);
+    }
 }
@@ -15,9 +15,12 @@
 ***** TYPES *********
 ********************/
 
+// text is terminated for text frames, binary frames come with binary set
 typedef struct {
     con_id_t con;
     char *text;
+    size_t len;
+    bool binary;
 } ws_msg_t;
 
 /********************
@@ -30,3 +33,4 @@ void        http_start(con_mode_t mode);
 void        http_stop(void);
 void        http_close(int sockfd);
 void        http_send_ws_msg(con_id_t con, const char *text);
+void        http_send_ws_bin(con_id_t con, const uint8_t *data, size_t len);
@@ -0,0 +1,62 @@
+#include <stdlib.h>
+
+#include "arena.h"
+
+/***************************
+***** CONSTANTS ************
+***************************/
+
+#define ALIGNMENT 8
+
+/***************************
+***** MACROS ***************
+***************************/
+
+/***************************
+***** TYPES ****************
+***************************/
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+/***************************
+***** LOCAL VARIABLES ******
+***************************/
+
+/***************************
+***** PUBLIC FUNCTIONS *****
+***************************/
+
+void arena_init(arena_t *a, size_t size) {
+    a->buf = NULL;
+    a->size = size;
+    a->used = 0;
+    a->active = false;
+}
+
+// NULL if the arena is inactive or full, the caller falls back to the heap
+void *arena_alloc(arena_t *a, size_t size) {
+    // every allocation takes at least one byte so it lies inside the block
+    size_t len = size ? (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1) : ALIGNMENT;
+    if (!a->active || len < size || len > a->size - a->used) {
+        return NULL;
+    }
+    if (!a->buf && !(a->buf = malloc(a->size))) {
+        a->size = 0;
+        return NULL;
+    }
+    void *ptr = a->buf + a->used;
+    a->used += len;
+    return ptr;
+}
+
+bool arena_owns(const arena_t *a, const void *ptr) {
+    return a && a->buf && (const uint8_t *)ptr >= a->buf && (const uint8_t *)ptr < a->buf + a->size;
+}
+
+void arena_free(arena_t *a) {
+    free(a->buf);
+    a->buf = NULL;
+    a->used = 0;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// a bump allocator, the block is only allocated on first use and everything
+// in it is released at once by arena_free
+typedef struct {
+    uint8_t *buf;
+    size_t  size;
+    size_t  used;
+    bool    active;
+} arena_t;
+
+void  arena_init(arena_t *a, size_t size);
+void *arena_alloc(arena_t *a, size_t size);
+bool  arena_owns(const arena_t *a, const void *ptr);
+void  arena_free(arena_t *a);
@@ -0,0 +1,328 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cbor.h"
+
+/***************************
+***** CONSTANTS ************
+***************************/
+
+#define MAX_DEPTH 32
+#define BREAK     0xFF
+
+/***************************
+***** MACROS ***************
+***************************/
+
+/***************************
+***** TYPES ****************
+***************************/
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static bool cbor_head(const uint8_t **pos, const uint8_t *end, cbor_t *item);
+static bool cbor_skip(const uint8_t **pos, const uint8_t *end, cbor_t *item, int depth);
+static size_t cbor_length(const cbor_t *item);
+static size_t cbor_copy(const cbor_t *item, char *buf, size_t size);
+static char *cbor_strdup(const cbor_t *item);
+static double cbor_half(uint16_t half);
+
+/***************************
+***** LOCAL VARIABLES ******
+***************************/
+
+/***************************
+***** PUBLIC FUNCTIONS *****
+***************************/
+
+// checks the item at *pos including everything nested in it and moves *pos behind it
+bool cbor_item(const uint8_t **pos, const uint8_t *end, cbor_t *item) {
+    return cbor_skip(pos, end, item, 0);
+}
+
+// walks the chunks of a string, the elements of an array, the keys and values
+// of a map in turn or the content of a tag, *pos starts out NULL
+bool cbor_next(const cbor_t *item, const uint8_t **pos, cbor_t *child) {
+    const uint8_t *p = *pos ? *pos : item->data;
+    const uint8_t *end = item->start + item->len - (item->indefinite ? 1 : 0);
+    if (p >= end || !cbor_item(&p, end, child)) {
+        return false;
+    }
+    *pos = p;
+    return true;
+}
+
+// copies a text or byte string into buf, returns size if it does not fit
+// like tok_string, text with an embedded NUL fits no buffer, so it can't
+// pass for a shorter string
+size_t cbor_string(const cbor_t *item, char *buf, size_t size) {
+    size_t len = cbor_copy(item, buf, size);
+    if (len < size && memchr(buf, '\0', len)) {
+        return size;
+    }
+    return len;
+}
+
+bool cbor_number(const cbor_t *item, double *value) {
+    if (item->major == CBOR_UINT) {
+        *value = item->arg;
+    } else if (item->major == CBOR_NINT) {
+        *value = -1.0 - item->arg;
+    } else if (item->major == CBOR_SIMPLE && item->info == 25) {
+        *value = cbor_half(item->arg);
+    } else if (item->major == CBOR_SIMPLE && item->info == 26) {
+        uint32_t bits = item->arg;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        *value = f;
+    } else if (item->major == CBOR_SIMPLE && item->info == 27) {
+        memcpy(value, &item->arg, sizeof(double));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// builds a cJSON tree for a param parser, byte strings become hex strings
+// and map keys must be text, NULL if the item has no JSON equivalent
+cJSON *cbor_json(const cbor_t *item) {
+    cJSON *json = NULL;
+    const uint8_t *pos = NULL;
+    cbor_t child;
+    double number;
+    char *str;
+
+    switch (item->major) {
+        case CBOR_BYTES:
+            if ((str = cbor_strdup(item))) {
+                size_t len = cbor_length(item);
+                char *hex = malloc(2 * len + 1);
+                if (hex) {
+                    for (size_t i = 0; i < len; ++i) {
+                        hex[2 * i] = "0123456789abcdef"[(uint8_t)str[i] >> 4];
+                        hex[2 * i + 1] = "0123456789abcdef"[(uint8_t)str[i] & 0xF];
+                    }
+                    hex[2 * len] = '\0';
+                    json = cJSON_CreateString(hex);
+                    free(hex);
+                }
+                free(str);
+            }
+            break;
+        case CBOR_TEXT:
+            if ((str = cbor_strdup(item))) {
+                json = cJSON_CreateString(str);
+                free(str);
+            }
+            break;
+        case CBOR_ARRAY:
+            json = cJSON_CreateArray();
+            while (json && cbor_next(item, &pos, &child)) {
+                cJSON *element = cbor_json(&child);
+                if (!element) {
+                    cJSON_Delete(json);
+                    return NULL;
+                }
+                cJSON_AddItemToArray(json, element);
+            }
+            break;
+        case CBOR_MAP:
+            json = cJSON_CreateObject();
+            while (json && cbor_next(item, &pos, &child)) {
+                cJSON *member = NULL;
+                str = child.major == CBOR_TEXT ? cbor_strdup(&child) : NULL;
+                if (str && cbor_next(item, &pos, &child)) {
+                    member = cbor_json(&child);
+                }
+                if (!member) {
+                    free(str);
+                    cJSON_Delete(json);
+                    return NULL;
+                }
+                cJSON_AddItemToObject(json, str, member);
+                free(str);
+            }
+            break;
+        case CBOR_TAG:
+            if (cbor_next(item, &pos, &child)) {
+                json = cbor_json(&child);
+            }
+            break;
+        default:
+            if (cbor_number(item, &number)) {
+                json = cJSON_CreateNumber(number);
+            } else if (item->info == 20 || item->info == 21) {
+                json = cJSON_CreateBool(item->info == 21);
+            } else {
+                json = cJSON_CreateNull();
+            }
+            break;
+    }
+    return json;
+}
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static bool cbor_head(const uint8_t **pos, const uint8_t *end, cbor_t *item) {
+    const uint8_t *p = *pos;
+    if (p >= end) {
+        return false;
+    }
+    item->start = p;
+    item->major = *p >> 5;
+    item->info = *p & 0x1F;
+    item->indefinite = false;
+    item->arg = 0;
+    p++;
+    if (item->info < 24) {
+        item->arg = item->info;
+    } else if (item->info < 28) {
+        int n = 1 << (item->info - 24);
+        if (end - p < n) {
+            return false;
+        }
+        while (n--) {
+            item->arg = item->arg << 8 | *p++;
+        }
+    } else if (item->info == 31 && item->major >= CBOR_BYTES && item->major <= CBOR_MAP) {
+        item->indefinite = true;
+    } else {
+        return false;
+    }
+    item->data = p;
+    *pos = p;
+    return true;
+}
+
+static bool cbor_skip(const uint8_t **pos, const uint8_t *end, cbor_t *item, int depth) {
+    const uint8_t *p = *pos;
+    cbor_t child;
+    if (depth == MAX_DEPTH || !cbor_head(&p, end, item)) {
+        return false;
+    }
+    switch (item->major) {
+        case CBOR_BYTES:
+        case CBOR_TEXT:
+            if (item->indefinite) {
+                // definite chunks of the same type up to the break
+                while (p < end && *p != BREAK) {
+                    if (!cbor_head(&p, end, &child) || child.major != item->major || child.indefinite || (uint64_t)(end - p) < child.arg) {
+                        return false;
+                    }
+                    p += child.arg;
+                }
+                if (p++ >= end) {
+                    return false;
+                }
+            } else {
+                if ((uint64_t)(end - p) < item->arg) {
+                    return false;
+                }
+                p += item->arg;
+            }
+            break;
+        case CBOR_ARRAY:
+        case CBOR_MAP:
+            if (item->indefinite) {
+                uint64_t cnt = 0;
+                while (p < end && *p != BREAK) {
+                    if (!cbor_skip(&p, end, &child, depth + 1)) {
+                        return false;
+                    }
+                    cnt++;
+                }
+                if (p++ >= end || (item->major == CBOR_MAP && cnt % 2)) {
+                    return false;
+                }
+            } else {
+                uint64_t cnt = item->arg;
+                if (cnt > (uint64_t)(end - p) || (item->major == CBOR_MAP && (cnt *= 2) > (uint64_t)(end - p))) {
+                    return false;
+                }
+                while (cnt--) {
+                    if (!cbor_skip(&p, end, &child, depth + 1)) {
+                        return false;
+                    }
+                }
+            }
+            break;
+        case CBOR_TAG:
+            if (!cbor_skip(&p, end, &child, depth + 1)) {
+                return false;
+            }
+            break;
+        default:
+            // integers, floats and simple values end with their head
+            break;
+    }
+    item->len = p - item->start;
+    *pos = p;
+    return true;
+}
+
+static size_t cbor_length(const cbor_t *item) {
+    if (!item->indefinite) {
+        return item->arg;
+    }
+    size_t len = 0;
+    const uint8_t *pos = NULL;
+    cbor_t chunk;
+    while (cbor_next(item, &pos, &chunk)) {
+        len += chunk.arg;
+    }
+    return len;
+}
+
+static size_t cbor_copy(const cbor_t *item, char *buf, size_t size) {
+    if (!item->indefinite) {
+        if (item->arg >= size) {
+            return size;
+        }
+        memcpy(buf, item->data, item->arg);
+        buf[item->arg] = '\0';
+        return item->arg;
+    }
+    size_t len = 0;
+    const uint8_t *pos = NULL;
+    cbor_t chunk;
+    while (cbor_next(item, &pos, &chunk)) {
+        if (len + chunk.arg >= size) {
+            return size;
+        }
+        memcpy(buf + len, chunk.data, chunk.arg);
+        len += chunk.arg;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+// byte strings are copied as they are, NULL for text with an embedded NUL
+static char *cbor_strdup(const cbor_t *item) {
+    size_t len = cbor_length(item);
+    char *str = malloc(len + 1);
+    if (str && (item->major == CBOR_TEXT ? cbor_string(item, str, len + 1) : cbor_copy(item, str, len + 1)) > len) {
+        free(str);
+        str = NULL;
+    }
+    return str;
+}
+
+// half precision as in RFC 8949, appendix D
+static double cbor_half(uint16_t half) {
+    int exp = (half >> 10) & 0x1F;
+    int mant = half & 0x3FF;
+    double value;
+    if (exp == 0) {
+        value = ldexp(mant, -24);
+    } else if (exp != 31) {
+        value = ldexp(mant + 1024, exp - 25);
+    } else {
+        value = mant == 0 ? INFINITY : NAN;
+    }
+    return half & 0x8000 ? -value : value;
+}
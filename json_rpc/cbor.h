@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cJSON.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CBOR_UINT   0
+#define CBOR_NINT   1
+#define CBOR_BYTES  2
+#define CBOR_TEXT   3
+#define CBOR_ARRAY  4
+#define CBOR_MAP    5
+#define CBOR_TAG    6
+#define CBOR_SIMPLE 7
+
+// a data item in the request buffer, start and len cover the head and
+// everything nested, arg is the value, length or count from the head
+typedef struct {
+    uint8_t       major;
+    uint8_t       info;
+    bool          indefinite;
+    uint64_t      arg;
+    const uint8_t *start;
+    const uint8_t *data;
+    size_t        len;
+} cbor_t;
+
+bool   cbor_item(const uint8_t **pos, const uint8_t *end, cbor_t *item);
+bool   cbor_next(const cbor_t *item, const uint8_t **pos, cbor_t *child);
+size_t cbor_string(const cbor_t *item, char *buf, size_t size);
+bool   cbor_number(const cbor_t *item, double *value);
+cJSON *cbor_json(const cbor_t *item);
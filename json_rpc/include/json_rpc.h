@@ -1,12 +1,18 @@
 #pragma once
 
 #include <cJSON.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "message.h"
+
 /********************
 ***** CONSTANTS *****
 ********************/
 
+#define JSON_RPC_STATS_METHOD "rpc.stats"
+
 /********************
 ***** MACROS ********
 ********************/
@@ -15,15 +21,46 @@
 ***** TYPES *********
 ********************/
 
+typedef struct json_rpc_server json_rpc_server_t;
+typedef struct json_rpc_writer json_rpc_writer_t;
+typedef struct json_rpc_token json_rpc_token_t;
+
 typedef void (*json_rpc_handler_t)(void *ctx, void *params, void **result);
+typedef void (*json_rpc_async_handler_t)(void *ctx, void *params, json_rpc_token_t *token);
+typedef void (*json_rpc_sender_t)(void *ctx, char *response, size_t len, bool binary);
 typedef void *(*json_rpc_param_parser_t)(cJSON *params);
 typedef uint8_t (*json_rpc_result_builder_t)(void *result, cJSON **json);
+typedef uint8_t (*json_rpc_result_writer_t)(void *result, json_rpc_writer_t *writer);
 
+// a method needs either a result builder or a result writer, the writer
+// emits the result straight into the response without a cJSON tree
+//
+// with arena set the params tree and whatever cJSON allocates inside the
+// result builder come from a per-request arena, the param parser and the
+// builder must not keep any part of them beyond the request, without it
+// both trees are on the heap like any other cJSON tree
+//
+// an async handler returns without a result and hands the token to whatever
+// finishes the work, json_rpc_complete then sends the response through the
+// sender, so ctx must stay valid until then, binary tells a CBOR response
+// of len bytes from a JSON one, the sender has to be set before the first
+// async call; the params tree is deleted as soon as the async handler
+// returns, so the param parser has to copy out whatever the deferred work
+// needs instead of pointing into the tree, a sync handler keeps the tree
+// until its result is built
+//
+// with cache set the result of a call without params is kept and served
+// without running the handler again until json_rpc_invalidate is called or a
+// message arrives on one of the topics given to json_rpc_invalidate_on
 typedef struct {
     char                      *method;
     json_rpc_handler_t        handler;
     json_rpc_param_parser_t   param_parser;
     json_rpc_result_builder_t result_builder;
+    json_rpc_result_writer_t  result_writer;
+    json_rpc_async_handler_t  async_handler;
+    bool                      cache;
+    bool                      arena;
 } json_rpc_config_t;
 
 typedef struct {
@@ -31,9 +68,57 @@ typedef struct {
     char    *message;
 } json_rpc_error_config_t;
 
+typedef enum {
+    JSON_RPC_PHASE_PARSE,
+    JSON_RPC_PHASE_PARAMS,
+    JSON_RPC_PHASE_HANDLER,
+    JSON_RPC_PHASE_BUILD,
+    JSON_RPC_PHASE_SERIALIZE,
+    JSON_RPC_PHASE_MAX
+} json_rpc_phase_t;
+
+// time sums up the microseconds spent in each phase and wraps around, errors
+// counts the calls answered with an error, hits those answered from the cache
+typedef struct {
+    uint32_t calls;
+    uint32_t errors;
+    uint32_t hits;
+    uint32_t time[JSON_RPC_PHASE_MAX];
+} json_rpc_stats_t;
+
 /********************
 ***** FUNCTIONS *****
 ********************/
 
-void json_rpc_init(const json_rpc_config_t *cfg, const json_rpc_error_config_t *err_cfg);
-char *json_rpc_handle_request(void *ctx, const char *request);
+// every server has its own methods, sender, counters and cache and can be
+// used from several tasks at once, servers are never destroyed
+json_rpc_server_t *json_rpc_server_create(const json_rpc_config_t *cfg, const json_rpc_error_config_t *err_cfg);
+void     json_rpc_server_set_sender(json_rpc_server_t *server, json_rpc_sender_t send);
+// returns NULL if there is nothing to answer right away, because the request
+// held only notifications or async calls, or if memory ran out for the response
+char    *json_rpc_server_handle_request(json_rpc_server_t *server, void *ctx, const char *request);
+uint8_t *json_rpc_server_handle_request_cbor(json_rpc_server_t *server, void *ctx, const uint8_t *request, size_t len, size_t *response_len);
+bool     json_rpc_server_stats(json_rpc_server_t *server, const char *method, json_rpc_stats_t *stats);
+void     json_rpc_server_invalidate(json_rpc_server_t *server, const char *method);
+void     json_rpc_server_invalidate_on(json_rpc_server_t *server, const char *method, msg_type_t topic);
+void     json_rpc_complete(json_rpc_token_t *token, void *result);
+
+// the same on a default server, json_rpc_init must not run while requests do
+void     json_rpc_init(const json_rpc_config_t *cfg, const json_rpc_error_config_t *err_cfg);
+void     json_rpc_set_sender(json_rpc_sender_t send);
+char    *json_rpc_handle_request(void *ctx, const char *request);
+uint8_t *json_rpc_handle_request_cbor(void *ctx, const uint8_t *request, size_t len, size_t *response_len);
+bool     json_rpc_stats(const char *method, json_rpc_stats_t *stats);
+void     json_rpc_invalidate(const char *method);
+void     json_rpc_invalidate_on(const char *method, msg_type_t topic);
+
+void json_rpc_write_object(json_rpc_writer_t *writer);
+void json_rpc_write_array(json_rpc_writer_t *writer);
+void json_rpc_write_end(json_rpc_writer_t *writer);
+void json_rpc_write_key(json_rpc_writer_t *writer, const char *key);
+void json_rpc_write_string(json_rpc_writer_t *writer, const char *str);
+void json_rpc_write_bytes(json_rpc_writer_t *writer, const uint8_t *data, size_t len);
+void json_rpc_write_int(json_rpc_writer_t *writer, int64_t value);
+void json_rpc_write_double(json_rpc_writer_t *writer, double value);
+void json_rpc_write_bool(json_rpc_writer_t *writer, bool value);
+void json_rpc_write_null(json_rpc_writer_t *writer);
@@ -1,8 +1,18 @@
 #include <assert.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
+#include "cbor.h"
 #include "json_rpc.h"
+#include "tokenizer.h"
+#include "writer.h"
 
 /***************************
 ***** CONSTANTS ************
@@ -14,6 +24,9 @@
 #define JSON_RPC_INVALID_PARAMS     -32602
 #define JSON_RPC_INTERNAL_ERROR     -32603
 
+#define MAX_METHOD_LEN              64
+#define ARENA_SIZE                  CONFIG_JSON_RPC_ARENA_SIZE
+
 /***************************
 ***** MACROS ***************
 ***************************/
@@ -22,128 +35,738 @@
 ***** TYPES ****************
 ***************************/
 
+// a value of the request in either encoding, CBOR types are mapped onto the
+// tokenizer's, type is TOK_NONE for a missing one
+typedef struct {
+    tok_type_t type;
+    bool       binary;
+    union {
+        tok_t  tok;
+        cbor_t cbor;
+    };
+} value_t;
+
+typedef struct {
+    value_t jsonrpc;
+    value_t method;
+    value_t params;
+    value_t id;
+} envelope_t;
+
+typedef struct {
+    atomic_uint calls;
+    atomic_uint errors;
+    atomic_uint hits;
+    atomic_uint time[JSON_RPC_PHASE_MAX];
+} stats_t;
+
+// a result per encoding, valid while stored matches generation
+typedef struct {
+    atomic_uint generation;
+    unsigned    stored[2];
+    char        *result[2];
+    size_t      len[2];
+} cache_t;
+
+// a method to invalidate, the name is copied so it outlives the config
+typedef struct expiry {
+    struct expiry *next;
+    char          method[];
+} expiry_t;
+
+// the one bus subscription of a server to a topic
+typedef struct trigger {
+    struct json_rpc_server *server;
+    msg_type_t             topic;
+    expiry_t               *expiries;
+    struct trigger         *next;
+} trigger_t;
+
+// everything a dispatcher needs, the index and the per-method state are
+// allocated in the order of config, cache_mutex also guards them against a
+// reconfiguration while a trigger fires
+struct json_rpc_server {
+    const json_rpc_config_t       *config;
+    const json_rpc_config_t       **method_index;
+    size_t                        method_cnt;
+    const json_rpc_error_config_t *error_config;
+    json_rpc_sender_t             sender;
+    stats_t                       *method_stats;
+    cache_t                       *method_cache;
+    SemaphoreHandle_t             cache_mutex;
+    trigger_t                     *triggers;
+};
+
+struct json_rpc_token {
+    json_rpc_server_t *server;
+    const json_rpc_config_t *cfg;
+    void *ctx;
+    int id;
+    bool notification;
+    bool binary;
+};
+
 /***************************
 ***** LOCAL FUNCTIONS ******
 ***************************/
 
-static char *json_rpc_build_response(cJSON *result, int id);
-static char *json_rpc_build_error_msg(int16_t code, int *id);
-static char *json_rpc_error_message(int16_t code);
+static void json_rpc_setup(json_rpc_server_t *server, const json_rpc_config_t *cfg, const json_rpc_error_config_t *err_cfg);
+static char *json_rpc_handle(json_rpc_server_t *server, void *ctx, const value_t *req, json_rpc_writer_t *w, size_t *len, int64_t start);
+static void json_rpc_envelope(const value_t *req, envelope_t *env);
+static bool json_rpc_id(const value_t *value, int *id);
+static bool json_rpc_element(const value_t *arr, const void **pos, value_t *elem);
+static bool json_rpc_member(const value_t *obj, const void **pos, value_t *key, value_t *val);
+static void json_rpc_text(value_t *value);
+static void json_rpc_binary(value_t *value);
+static size_t json_rpc_string(const value_t *value, char *buf, size_t size);
+static cJSON *json_rpc_tree(const value_t *value);
+static const json_rpc_config_t *json_rpc_find(json_rpc_server_t *server, const char *method);
+static int json_rpc_compare(const void *a, const void *b);
+static int json_rpc_compare_key(const void *key, const void *elem);
+static void json_rpc_batch(json_rpc_server_t *server, void *ctx, const value_t *req, json_rpc_writer_t *w);
+static void json_rpc_call(json_rpc_server_t *server, void *ctx, const value_t *req, json_rpc_writer_t *w, int64_t start);
+static void json_rpc_result(json_rpc_server_t *server, json_rpc_writer_t *w, const json_rpc_config_t *cfg, void *result, int id, cache_t *cache, unsigned generation);
+static void json_rpc_discard(const json_rpc_config_t *cfg, void *result);
+static void json_rpc_error(json_rpc_server_t *server, json_rpc_writer_t *w, int16_t code, int *id);
+static char *json_rpc_error_message(json_rpc_server_t *server, int16_t code);
+static stats_t *json_rpc_stats_of(json_rpc_server_t *server, const json_rpc_config_t *cfg);
+static void json_rpc_time(stats_t *stats, json_rpc_phase_t phase, int64_t *since);
+static cache_t *json_rpc_cache_of(json_rpc_server_t *server, const json_rpc_config_t *cfg);
+static bool json_rpc_cached(json_rpc_server_t *server, json_rpc_writer_t *w, cache_t *cache, unsigned generation, int id);
+static void json_rpc_store(json_rpc_server_t *server, cache_t *cache, unsigned generation, bool binary, const char *data, size_t len);
+static void json_rpc_expire(void *ctx, const msg_t *msg);
+static void json_rpc_expire_method(json_rpc_server_t *server, const char *method);
+static void json_rpc_arena(bool active);
+static void *json_rpc_malloc(size_t size);
+static void json_rpc_free(void *ptr);
+static void json_rpc_stats_handler(void *ctx, void *params, void **result);
+static uint8_t json_rpc_stats_writer(void *result, json_rpc_writer_t *w);
 
 /***************************
 ***** LOCAL VARIABLES ******
 ***************************/
 
-static const json_rpc_config_t *config;
-static const json_rpc_error_config_t *error_config;
+// the dispatcher behind the functions without a server argument
+static json_rpc_server_t default_server;
+
+// the arena of the request the task is working on, cJSON only allocates from
+// it while json_rpc builds params or results of a method with arena set,
+// frees are recognised any time
+static __thread arena_t *arena;
+
+// the cJSON hooks are global and installed by the first server
+static portMUX_TYPE hooks_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool hooks_installed;
+
+static const json_rpc_config_t stats_config = {
+    .method = JSON_RPC_STATS_METHOD,
+    .handler = json_rpc_stats_handler,
+    .result_writer = json_rpc_stats_writer,
+};
+
+static const char *phase_names[JSON_RPC_PHASE_MAX] = { "parse", "params", "handler", "build", "serialize" };
 
 /***************************
 ***** PUBLIC FUNCTIONS *****
 ***************************/
 
+json_rpc_server_t *json_rpc_server_create(const json_rpc_config_t *cfg, const json_rpc_error_config_t *err_cfg) {
+    json_rpc_server_t *server = calloc(1, sizeof(json_rpc_server_t));
+    assert(server);
+    json_rpc_setup(server, cfg, err_cfg);
+    return server;
+}
+
+void json_rpc_server_set_sender(json_rpc_server_t *server, json_rpc_sender_t send) {
+    server->sender = send;
+}
+
+// the request is tokenized in place, only params are turned into a cJSON tree
+// and only for methods that have a param parser
+char *json_rpc_server_handle_request(json_rpc_server_t *server, void *ctx, const char *request) {
+    int64_t start = esp_timer_get_time();
+    json_rpc_writer_t w;
+    const char *pos = request;
+    value_t req = { 0 };
+
+    writer_init(&w, false);
+    if (tok_value(&pos, &req.tok) && tok_end(pos)) {
+        json_rpc_text(&req);
+        return json_rpc_handle(server, ctx, &req, &w, NULL, start);
+    }
+    return json_rpc_handle(server, ctx, NULL, &w, NULL, start);
+}
+
+// the same for CBOR, e.g. from websocket binary frames, the response is CBOR as well
+uint8_t *json_rpc_server_handle_request_cbor(json_rpc_server_t *server, void *ctx, const uint8_t *request, size_t len, size_t *response_len) {
+    int64_t start = esp_timer_get_time();
+    json_rpc_writer_t w;
+    const uint8_t *pos = request;
+    value_t req = { 0 };
+
+    writer_init(&w, true);
+    if (cbor_item(&pos, request + len, &req.cbor) && pos == request + len) {
+        json_rpc_binary(&req);
+        return (uint8_t *)json_rpc_handle(server, ctx, &req, &w, response_len, start);
+    }
+    return (uint8_t *)json_rpc_handle(server, ctx, NULL, &w, response_len, start);
+}
+
+// false for unknown methods, the built-in ones have no counters
+bool json_rpc_server_stats(json_rpc_server_t *server, const char *method, json_rpc_stats_t *stats) {
+    const json_rpc_config_t *cfg = json_rpc_find(server, method);
+    stats_t *s = cfg ? json_rpc_stats_of(server, cfg) : NULL;
+    if (!s) {
+        return false;
+    }
+    stats->calls = atomic_load_explicit(&s->calls, memory_order_relaxed);
+    stats->errors = atomic_load_explicit(&s->errors, memory_order_relaxed);
+    stats->hits = atomic_load_explicit(&s->hits, memory_order_relaxed);
+    for (int i = 0; i < JSON_RPC_PHASE_MAX; ++i) {
+        stats->time[i] = atomic_load_explicit(&s->time[i], memory_order_relaxed);
+    }
+    return true;
+}
+
+// may be called from any task, a call already running does not store its result
+void json_rpc_server_invalidate(json_rpc_server_t *server, const char *method) {
+    xSemaphoreTake(server->cache_mutex, portMAX_DELAY);
+    json_rpc_expire_method(server, method);
+    xSemaphoreGive(server->cache_mutex);
+}
+
+// a server subscribes to each topic once, whatever the number of methods, the
+// methods are looked up by name when a message arrives, so they follow a
+// reconfiguration and are skipped once they are gone
+void json_rpc_server_invalidate_on(json_rpc_server_t *server, const char *method, msg_type_t topic) {
+    trigger_t *trigger;
+    expiry_t *expiry;
+    bool subscribe = false;
+
+    xSemaphoreTake(server->cache_mutex, portMAX_DELAY);
+    const json_rpc_config_t *cfg = json_rpc_find(server, method);
+    assert(cfg && cfg->cache);
+    for (trigger = server->triggers; trigger && trigger->topic != topic; trigger = trigger->next) {
+    }
+    if (!trigger) {
+        trigger = calloc(1, sizeof(trigger_t));
+        assert(trigger);
+        trigger->server = server;
+        trigger->topic = topic;
+        trigger->next = server->triggers;
+        server->triggers = trigger;
+        subscribe = true;
+    }
+    for (expiry = trigger->expiries; expiry && strcmp(expiry->method, method); expiry = expiry->next) {
+    }
+    if (!expiry) {
+        expiry = malloc(sizeof(expiry_t) + strlen(method) + 1);
+        assert(expiry);
+        strcpy(expiry->method, method);
+        expiry->next = trigger->expiries;
+        trigger->expiries = expiry;
+    }
+    xSemaphoreGive(server->cache_mutex);
+
+    if (subscribe) {
+        msg_subscribe(topic, json_rpc_expire, trigger);
+    }
+}
+
+// may be called from any task, the sender takes over the response
+void json_rpc_complete(json_rpc_token_t *token, void *result) {
+    json_rpc_server_t *server = token->server;
+    assert(server->sender);
+
+    if (token->notification) {
+        json_rpc_discard(token->cfg, result);
+    } else {
+        json_rpc_writer_t w;
+        arena_t a, *outer = arena;
+        arena_init(&a, ARENA_SIZE);
+        arena = &a;
+        writer_init(&w, token->binary);
+        json_rpc_result(server, &w, token->cfg, result, token->id, NULL, 0);
+        arena = outer;
+        arena_free(&a);
+        size_t len = w.len;
+        char *response = writer_finish(&w);
+        if (response) {
+            server->sender(token->ctx, response, len, token->binary);
+        }
+    }
+    free(token);
+}
+
 void json_rpc_init(const json_rpc_config_t *cfg, const json_rpc_error_config_t *err_cfg) {
-    config = cfg;
-    error_config = err_cfg;
+    json_rpc_setup(&default_server, cfg, err_cfg);
+}
+
+void json_rpc_set_sender(json_rpc_sender_t send) {
+    json_rpc_server_set_sender(&default_server, send);
 }
 
 char *json_rpc_handle_request(void *ctx, const char *request) {
-    assert(config);
+    return json_rpc_server_handle_request(&default_server, ctx, request);
+}
 
-    int *idptr = NULL;
-    char *response = NULL;
+uint8_t *json_rpc_handle_request_cbor(void *ctx, const uint8_t *request, size_t len, size_t *response_len) {
+    return json_rpc_server_handle_request_cbor(&default_server, ctx, request, len, response_len);
+}
+
+bool json_rpc_stats(const char *method, json_rpc_stats_t *stats) {
+    return json_rpc_server_stats(&default_server, method, stats);
+}
+
+void json_rpc_invalidate(const char *method) {
+    json_rpc_server_invalidate(&default_server, method);
+}
+
+void json_rpc_invalidate_on(const char *method, msg_type_t topic) {
+    json_rpc_server_invalidate_on(&default_server, method, topic);
+}
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+// also reconfigures an existing server, which must not handle requests
+// meanwhile, invalidations wait on the cache mutex
+static void json_rpc_setup(json_rpc_server_t *server, const json_rpc_config_t *cfg, const json_rpc_error_config_t *err_cfg) {
+    cJSON_Hooks hooks = {
+        .malloc_fn = json_rpc_malloc,
+        .free_fn = json_rpc_free,
+    };
+    // cJSON_InitHooks resets the hooks to malloc and free before it installs
+    // them, so it must not run again while other servers free arena trees
+    portENTER_CRITICAL(&hooks_lock);
+    if (!hooks_installed) {
+        cJSON_InitHooks(&hooks);
+        hooks_installed = true;
+    }
+    portEXIT_CRITICAL(&hooks_lock);
+
+    if (!server->cache_mutex) {
+        server->cache_mutex = xSemaphoreCreateMutex();
+        assert(server->cache_mutex);
+    }
+    xSemaphoreTake(server->cache_mutex, portMAX_DELAY);
+
+    // cached results of a previous configuration are dropped
+    for (size_t i = 0; server->method_cache && i < server->method_cnt; ++i) {
+        free(server->method_cache[i].result[0]);
+        free(server->method_cache[i].result[1]);
+    }
+    free(server->method_cache);
+
+    server->config = cfg;
+    server->error_config = err_cfg;
+
+    // methods are looked up by binary search in an index sorted by name
+    free(server->method_index);
+    server->method_cnt = 0;
+    while (cfg[server->method_cnt].method) {
+        server->method_cnt++;
+    }
+    server->method_index = malloc(server->method_cnt * sizeof(json_rpc_config_t *));
+    assert(server->method_index || !server->method_cnt);
+    for (size_t i = 0; i < server->method_cnt; ++i) {
+        server->method_index[i] = &cfg[i];
+    }
+    qsort(server->method_index, server->method_cnt, sizeof(json_rpc_config_t *), json_rpc_compare);
+    for (size_t i = 1; i < server->method_cnt; ++i) {
+        assert(strcmp(server->method_index[i - 1]->method, server->method_index[i]->method));
+    }
+
+    // one set of counters per method, in the order of cfg
+    free(server->method_stats);
+    server->method_stats = calloc(server->method_cnt, sizeof(stats_t));
+    assert(server->method_stats || !server->method_cnt);
 
-    cJSON *req = cJSON_Parse(request);
+    server->method_cache = calloc(server->method_cnt, sizeof(cache_t));
+    assert(server->method_cache || !server->method_cnt);
+    xSemaphoreGive(server->cache_mutex);
+}
+
+// req is NULL if it could not be parsed, start is when parsing began
+static char *json_rpc_handle(json_rpc_server_t *server, void *ctx, const value_t *req, json_rpc_writer_t *w, size_t *len, int64_t start) {
+    assert(server->config);
+
+    // handlers may process requests of their own
+    arena_t a, *outer = arena;
+    arena_init(&a, ARENA_SIZE);
+    arena = &a;
+    if (!req) {
+        json_rpc_error(server, w, JSON_RPC_PARSE_ERROR, NULL);
+    } else if (req->type == TOK_ARRAY) {
+        json_rpc_batch(server, ctx, req, w);
+    } else {
+        json_rpc_call(server, ctx, req, w, start);
+    }
+    arena = outer;
+    arena_free(&a);
+    if (!w->len) {
+        // only notifications, nothing to answer
+        writer_free(w);
+        return NULL;
+    }
+    if (len) {
+        *len = w->len;
+    }
+    return writer_finish(w);
+}
+
+// the calls of a batch are answered in one array, an empty batch is invalid
+// and a batch of notifications is not answered at all, async calls are
+// answered on their own when they complete
+static void json_rpc_batch(json_rpc_server_t *server, void *ctx, const value_t *req, json_rpc_writer_t *w) {
+    json_rpc_writer_t mark = *w;
+    const void *pos = NULL;
+    value_t call;
+
+    if (!json_rpc_element(req, &pos, &call)) {
+        json_rpc_error(server, w, JSON_RPC_INVALID_REQUEST, NULL);
+        return;
+    }
+    json_rpc_write_array(w);
+    do {
+        json_rpc_call(server, ctx, &call, w, esp_timer_get_time());
+    } while (json_rpc_element(req, &pos, &call));
+    if (w->empty & 1) {
+        writer_rewind(w, &mark);
+    } else {
+        json_rpc_write_end(w);
+    }
+}
+
+// the phases up to the handler are timed here, the rest in json_rpc_result
+static void json_rpc_call(json_rpc_server_t *server, void *ctx, const value_t *req, json_rpc_writer_t *w, int64_t start) {
+    envelope_t env = { 0 };
+    char version[4];
+    char method[MAX_METHOD_LEN];
+    int id = 0;
+    int *idptr = NULL;
+    bool notification;
 
-    if (req) {
-        cJSON *jsonrpc = cJSON_GetObjectItemCaseSensitive(req, "jsonrpc");
-        cJSON *method = cJSON_GetObjectItemCaseSensitive(req, "method");
-        cJSON *params = cJSON_GetObjectItemCaseSensitive(req, "params");
-        cJSON *id = cJSON_GetObjectItemCaseSensitive(req, "id");
-        if (cJSON_IsNumber(id)) {
-            idptr = &id->valueint;
+    json_rpc_envelope(req, &env);
+    // a request without id is a notification, only an invalid one gets an answer
+    notification = !env.id.type;
+    if (env.id.type == TOK_NUMBER && json_rpc_id(&env.id, &id)) {
+        idptr = &id;
+    }
+    if (   env.jsonrpc.type == TOK_STRING
+        && json_rpc_string(&env.jsonrpc, version, sizeof(version)) < sizeof(version)
+        && !strcmp(version, "2.0")
+        && env.method.type == TOK_STRING
+        && (!env.params.type || env.params.type == TOK_ARRAY || env.params.type == TOK_OBJECT)
+        && (idptr || notification)) {
+        const json_rpc_config_t *cfg = NULL;
+        if (json_rpc_string(&env.method, method, sizeof(method)) < sizeof(method)) {
+            cfg = json_rpc_find(server, method);
         }
-        if (   cJSON_IsString(jsonrpc)
-            && !strcmp(jsonrpc->valuestring, "2.0")
-            && cJSON_IsString(method)
-            && (!params || cJSON_IsArray(params) || cJSON_IsObject(params))
-            && idptr) {
-            const json_rpc_config_t *cfg = config;
-            while (cfg->method) {
-                if (!strcmp(method->valuestring, cfg->method)) {
-                    break;
+        if (cfg && (cfg->handler || cfg->async_handler) && (cfg->result_builder || cfg->result_writer)) {
+            stats_t *stats = json_rpc_stats_of(server, cfg);
+            cache_t *cache = notification || env.params.type || cfg->async_handler ? NULL : json_rpc_cache_of(server, cfg);
+            unsigned generation = cache ? atomic_load(&cache->generation) : 0;
+            void *parameters = NULL;
+            cJSON *params = NULL;
+            bool valid = true;
+            if (stats) {
+                atomic_fetch_add_explicit(&stats->calls, 1, memory_order_relaxed);
+            }
+            json_rpc_time(stats, JSON_RPC_PHASE_PARSE, &start);
+            if (cache && json_rpc_cached(server, w, cache, generation, id)) {
+                if (stats) {
+                    atomic_fetch_add_explicit(&stats->hits, 1, memory_order_relaxed);
                 }
-                cfg++;
+                json_rpc_time(stats, JSON_RPC_PHASE_SERIALIZE, &start);
+                return;
             }
-            if (cfg->method && cfg->handler && cfg->result_builder) {
-                void *parameters = NULL;
-                if (cfg->param_parser) {
-                    if (!(parameters = cfg->param_parser(params))) {
-                        response = json_rpc_build_error_msg(JSON_RPC_INVALID_PARAMS, idptr);
-                    }
-                } else if (params) {
-                    response = json_rpc_build_error_msg(JSON_RPC_INVALID_PARAMS, idptr);
+            if (cfg->param_parser) {
+                if (env.params.type) {
+                    json_rpc_arena(cfg->arena);
+                    params = json_rpc_tree(&env.params);
+                    json_rpc_arena(false);
                 }
-                if (!response) {
-                    void *result = NULL;
-                    cJSON *json_result = NULL;
-                    cfg->handler(ctx, parameters, &result);
-                    uint8_t error = cfg->result_builder(result, &json_result);
-                    if (error) {
-                        response = json_rpc_build_error_msg(error, idptr);
-                    } else {
-                        response = json_rpc_build_response(json_result, *idptr);
-                    }
+                valid = (parameters = cfg->param_parser(params));
+            } else if (env.params.type) {
+                valid = false;
+            }
+            if (cfg == &stats_config) {
+                // the built-in method reports on the server it was called on
+                parameters = server;
+            }
+            json_rpc_time(stats, JSON_RPC_PHASE_PARAMS, &start);
+            if (valid && cfg->async_handler) {
+                // fail here rather than on the task that completes the call
+                assert(server->sender);
+                json_rpc_token_t *token = malloc(sizeof(json_rpc_token_t));
+                assert(token);
+                token->server = server;
+                token->cfg = cfg;
+                token->ctx = ctx;
+                token->id = id;
+                token->notification = notification;
+                token->binary = req->binary;
+                cfg->async_handler(ctx, parameters, token);
+                json_rpc_time(stats, JSON_RPC_PHASE_HANDLER, &start);
+            } else if (valid) {
+                void *result = NULL;
+                cfg->handler(ctx, parameters, &result);
+                json_rpc_time(stats, JSON_RPC_PHASE_HANDLER, &start);
+                if (notification) {
+                    json_rpc_discard(cfg, result);
+                } else {
+                    json_rpc_result(server, w, cfg, result, id, cache, generation);
                 }
             } else {
-                response = json_rpc_build_error_msg(JSON_RPC_METHOD_NOT_FOUND, idptr);
+                if (stats) {
+                    atomic_fetch_add_explicit(&stats->errors, 1, memory_order_relaxed);
+                }
+                if (!notification) {
+                    json_rpc_error(server, w, JSON_RPC_INVALID_PARAMS, idptr);
+                }
             }
-        } else {
-            response = json_rpc_build_error_msg(JSON_RPC_INVALID_REQUEST, idptr);
+            cJSON_Delete(params);
+        } else if (!notification) {
+            json_rpc_error(server, w, JSON_RPC_METHOD_NOT_FOUND, idptr);
         }
-        cJSON_Delete(req);
     } else {
-        response = json_rpc_build_error_msg(JSON_RPC_PARSE_ERROR, idptr);
+        json_rpc_error(server, w, JSON_RPC_INVALID_REQUEST, idptr);
     }
-    return response;
 }
 
-/***************************
-***** LOCAL FUNCTIONS ******
-***************************/
+// like cJSON_GetObjectItemCaseSensitive, the first of duplicate members wins
+static void json_rpc_envelope(const value_t *req, envelope_t *env) {
+    if (req->type != TOK_OBJECT) {
+        return;
+    }
+    const void *pos = NULL;
+    value_t key, val;
+    while (json_rpc_member(req, &pos, &key, &val)) {
+        char name[8];
+        if (key.type != TOK_STRING || json_rpc_string(&key, name, sizeof(name)) == sizeof(name)) {
+            continue;
+        }
+        value_t *member = NULL;
+        if (!strcmp(name, "jsonrpc")) {
+            member = &env->jsonrpc;
+        } else if (!strcmp(name, "method")) {
+            member = &env->method;
+        } else if (!strcmp(name, "params")) {
+            member = &env->params;
+        } else if (!strcmp(name, "id")) {
+            member = &env->id;
+        }
+        if (member && !member->type) {
+            *member = val;
+        }
+    }
+}
+
+// same saturation as cJSON's valueint
+// false for nan and infinity, which CBOR can carry and no int can hold
+static bool json_rpc_id(const value_t *value, int *id) {
+    double number = 0;
+    if (value->binary) {
+        cbor_number(&value->cbor, &number);
+    } else {
+        number = strtod(value->tok.start, NULL);
+    }
+    if (number * 0 != 0) {
+        return false;
+    }
+    if (number >= INT_MAX) {
+        *id = INT_MAX;
+    } else if (number <= (double)INT_MIN) {
+        *id = INT_MIN;
+    } else {
+        *id = (int)number;
+    }
+    return true;
+}
+
+static bool json_rpc_element(const value_t *arr, const void **pos, value_t *elem) {
+    elem->binary = arr->binary;
+    if (arr->binary) {
+        if (!cbor_next(&arr->cbor, (const uint8_t **)pos, &elem->cbor)) {
+            return false;
+        }
+        json_rpc_binary(elem);
+    } else {
+        if (!tok_element(&arr->tok, (const char **)pos, &elem->tok)) {
+            return false;
+        }
+        json_rpc_text(elem);
+    }
+    return true;
+}
+
+static bool json_rpc_member(const value_t *obj, const void **pos, value_t *key, value_t *val) {
+    if (obj->binary) {
+        return json_rpc_element(obj, pos, key) && json_rpc_element(obj, pos, val);
+    }
+    key->binary = val->binary = false;
+    if (!tok_member(&obj->tok, (const char **)pos, &key->tok, &val->tok)) {
+        return false;
+    }
+    json_rpc_text(key);
+    json_rpc_text(val);
+    return true;
+}
+
+static void json_rpc_text(value_t *value) {
+    value->binary = false;
+    value->type = value->tok.type;
+}
+
+// a tagged value keeps its type, everything without a counterpart counts as null
+static void json_rpc_binary(value_t *value) {
+    const cbor_t *item = &value->cbor;
+    cbor_t content;
+    while (item->major == CBOR_TAG) {
+        const uint8_t *pos = NULL;
+        cbor_next(item, &pos, &content);
+        item = &content;
+    }
+    value->binary = true;
+    switch (item->major) {
+        case CBOR_UINT:
+        case CBOR_NINT:
+            value->type = TOK_NUMBER;
+            break;
+        case CBOR_TEXT:
+            value->type = TOK_STRING;
+            break;
+        case CBOR_ARRAY:
+            value->type = TOK_ARRAY;
+            break;
+        case CBOR_MAP:
+            value->type = TOK_OBJECT;
+            break;
+        case CBOR_SIMPLE:
+            value->type = item->info >= 25 && item->info <= 27 ? TOK_NUMBER : item->info == 20 ? TOK_FALSE : item->info == 21 ? TOK_TRUE : TOK_NULL;
+            break;
+        default:
+            value->type = TOK_NULL;
+            break;
+    }
+    value->cbor = *item;
+}
+
+static size_t json_rpc_string(const value_t *value, char *buf, size_t size) {
+    if (value->binary) {
+        return cbor_string(&value->cbor, buf, size);
+    }
+    return tok_string(&value->tok, buf, size);
+}
 
-static char *json_rpc_build_response(cJSON *result, int id) {
-    cJSON *resp = cJSON_CreateObject();
+static cJSON *json_rpc_tree(const value_t *value) {
+    if (value->binary) {
+        return cbor_json(&value->cbor);
+    }
+    return cJSON_ParseWithLength(value->tok.start, value->tok.len);
+}
 
-    cJSON_AddStringToObject(resp, "jsonrpc", "2.0");
-    cJSON_AddItemToObject(resp, "result", result);
-    cJSON_AddNumberToObject(resp, "id", id);
+// the configured methods take precedence over the built-in ones
+static const json_rpc_config_t *json_rpc_find(json_rpc_server_t *server, const char *method) {
+    const json_rpc_config_t **cfg = bsearch(method, server->method_index, server->method_cnt, sizeof(json_rpc_config_t *), json_rpc_compare_key);
+    if (cfg) {
+        return *cfg;
+    }
+    return strcmp(method, JSON_RPC_STATS_METHOD) ? NULL : &stats_config;
+}
 
-    char *response = cJSON_PrintUnformatted(resp);
-    cJSON_Delete(resp);
-    return response;
+static int json_rpc_compare(const void *a, const void *b) {
+    return strcmp((*(const json_rpc_config_t **)a)->method, (*(const json_rpc_config_t **)b)->method);
 }
 
-static char *json_rpc_build_error_msg(int16_t code, int *id) {
-    cJSON *resp = cJSON_CreateObject();
-    cJSON *err = cJSON_CreateObject();
+static int json_rpc_compare_key(const void *key, const void *elem) {
+    return strcmp(key, (*(const json_rpc_config_t **)elem)->method);
+}
 
-    cJSON_AddStringToObject(resp, "jsonrpc", "2.0");
-    cJSON_AddItemToObject(resp, "error", err);
-    cJSON_AddNumberToObject(err, "code", code);
-    cJSON_AddStringToObject(err, "message", json_rpc_error_message(code));
+// the envelope is written around the result directly, a legacy builder's
+// tree is walked into the same buffer, a failed result is cut off again
+// a result writer counts as serializing since it builds nothing, with cache
+// the result is kept unless it was invalidated since generation was read
+static void json_rpc_result(json_rpc_server_t *server, json_rpc_writer_t *w, const json_rpc_config_t *cfg, void *result, int id, cache_t *cache, unsigned generation) {
+    json_rpc_writer_t mark = *w;
+    stats_t *stats = json_rpc_stats_of(server, cfg);
+    int64_t since = esp_timer_get_time();
+    uint8_t error;
 
-    if (id) {
-        cJSON_AddNumberToObject(resp, "id", *id);
+    json_rpc_write_object(w);
+    json_rpc_write_key(w, "jsonrpc");
+    json_rpc_write_string(w, "2.0");
+    json_rpc_write_key(w, "result");
+    size_t from = w->len;
+    if (cfg->result_writer) {
+        error = cfg->result_writer(result, w);
+    } else {
+        cJSON *json = NULL;
+        json_rpc_arena(cfg->arena);
+        error = cfg->result_builder(result, &json);
+        json_rpc_time(stats, JSON_RPC_PHASE_BUILD, &since);
+        if (!error) {
+            writer_json(w, json);
+        }
+        cJSON_Delete(json);
+        json_rpc_arena(false);
+    }
+    json_rpc_time(stats, JSON_RPC_PHASE_SERIALIZE, &since);
+    if (error) {
+        if (stats) {
+            atomic_fetch_add_explicit(&stats->errors, 1, memory_order_relaxed);
+        }
+        writer_rewind(w, &mark);
+        json_rpc_error(server, w, error, &id);
+        return;
+    }
+    if (cache && !w->failed) {
+        json_rpc_store(server, cache, generation, w->cbor, w->buf + from, w->len - from);
+    }
+    json_rpc_write_key(w, "id");
+    json_rpc_write_int(w, id);
+    json_rpc_write_end(w);
+}
+
+// nothing is sent for a notification, the builder only runs to release the
+// result, a result writer writes into the void
+static void json_rpc_discard(const json_rpc_config_t *cfg, void *result) {
+    if (cfg->result_writer) {
+        json_rpc_writer_t w;
+        writer_null(&w);
+        cfg->result_writer(result, &w);
     } else {
-        cJSON_AddNullToObject(resp, "id");
+        cJSON *json = NULL;
+        json_rpc_arena(cfg->arena);
+        cfg->result_builder(result, &json);
+        cJSON_Delete(json);
+        json_rpc_arena(false);
     }
+}
 
-    char *response = cJSON_PrintUnformatted(resp);
-    cJSON_Delete(resp);
-    return response;
+static void json_rpc_error(json_rpc_server_t *server, json_rpc_writer_t *w, int16_t code, int *id) {
+    json_rpc_write_object(w);
+    json_rpc_write_key(w, "jsonrpc");
+    json_rpc_write_string(w, "2.0");
+    json_rpc_write_key(w, "error");
+    json_rpc_write_object(w);
+    json_rpc_write_key(w, "code");
+    json_rpc_write_int(w, code);
+    json_rpc_write_key(w, "message");
+    json_rpc_write_string(w, json_rpc_error_message(server, code));
+    json_rpc_write_end(w);
+    json_rpc_write_key(w, "id");
+    if (id) {
+        json_rpc_write_int(w, *id);
+    } else {
+        json_rpc_write_null(w);
+    }
+    json_rpc_write_end(w);
 }
 
-static char *json_rpc_error_message(int16_t code) {
+static char *json_rpc_error_message(json_rpc_server_t *server, int16_t code) {
     char *ret = "";
     switch (code) {
         case JSON_RPC_PARSE_ERROR:
@@ -162,7 +785,7 @@ static char *json_rpc_error_message(int16_t code) {
             ret = "internal error";
             break;
         default:
-            const json_rpc_error_config_t *err = error_config;
+            const json_rpc_error_config_t *err = server->error_config;
             while (err && err->code) {
                 if (code == err->code) {
                     ret = err->message;
@@ -174,3 +797,137 @@ static char *json_rpc_error_message(int16_t code) {
     }
     return ret;
 }
+
+static stats_t *json_rpc_stats_of(json_rpc_server_t *server, const json_rpc_config_t *cfg) {
+    if (!cfg || cfg == &stats_config) {
+        return NULL;
+    }
+    return &server->method_stats[cfg - server->config];
+}
+
+// adds the time since *since to the phase and starts the next one
+static void json_rpc_time(stats_t *stats, json_rpc_phase_t phase, int64_t *since) {
+    int64_t now = esp_timer_get_time();
+    if (stats) {
+        atomic_fetch_add_explicit(&stats->time[phase], (uint32_t)(now - *since), memory_order_relaxed);
+    }
+    *since = now;
+}
+
+static cache_t *json_rpc_cache_of(json_rpc_server_t *server, const json_rpc_config_t *cfg) {
+    if (!cfg->cache || cfg == &stats_config) {
+        return NULL;
+    }
+    return &server->method_cache[cfg - server->config];
+}
+
+// answers the call from the cache, a stale result is dropped on the way
+static bool json_rpc_cached(json_rpc_server_t *server, json_rpc_writer_t *w, cache_t *cache, unsigned generation, int id) {
+    bool hit = false;
+    xSemaphoreTake(server->cache_mutex, portMAX_DELAY);
+    if (cache->result[w->cbor] && cache->stored[w->cbor] != generation) {
+        free(cache->result[w->cbor]);
+        cache->result[w->cbor] = NULL;
+    }
+    if (cache->result[w->cbor]) {
+        json_rpc_write_object(w);
+        json_rpc_write_key(w, "jsonrpc");
+        json_rpc_write_string(w, "2.0");
+        json_rpc_write_key(w, "result");
+        writer_raw(w, cache->result[w->cbor], cache->len[w->cbor]);
+        json_rpc_write_key(w, "id");
+        json_rpc_write_int(w, id);
+        json_rpc_write_end(w);
+        hit = true;
+    }
+    xSemaphoreGive(server->cache_mutex);
+    return hit;
+}
+
+static void json_rpc_store(json_rpc_server_t *server, cache_t *cache, unsigned generation, bool binary, const char *data, size_t len) {
+    char *copy = malloc(len);
+    if (!copy) {
+        return;
+    }
+    memcpy(copy, data, len);
+    xSemaphoreTake(server->cache_mutex, portMAX_DELAY);
+    if (generation == atomic_load(&cache->generation)) {
+        char *old = cache->result[binary];
+        cache->result[binary] = copy;
+        cache->stored[binary] = generation;
+        cache->len[binary] = len;
+        copy = old;
+    }
+    xSemaphoreGive(server->cache_mutex);
+    free(copy);
+}
+
+// runs on a dispatcher task of the message bus
+static void json_rpc_expire(void *ctx, const msg_t *msg) {
+    trigger_t *trigger = ctx;
+    json_rpc_server_t *server = trigger->server;
+    xSemaphoreTake(server->cache_mutex, portMAX_DELAY);
+    for (expiry_t *expiry = trigger->expiries; expiry; expiry = expiry->next) {
+        json_rpc_expire_method(server, expiry->method);
+    }
+    xSemaphoreGive(server->cache_mutex);
+}
+
+// the caller holds the cache mutex
+static void json_rpc_expire_method(json_rpc_server_t *server, const char *method) {
+    const json_rpc_config_t *cfg = json_rpc_find(server, method);
+    cache_t *cache = cfg ? json_rpc_cache_of(server, cfg) : NULL;
+    if (cache) {
+        atomic_fetch_add(&cache->generation, 1);
+    }
+}
+
+static void json_rpc_arena(bool active) {
+    if (arena) {
+        arena->active = active;
+    }
+}
+
+// the heap takes whatever does not fit into the arena or comes from elsewhere
+static void *json_rpc_malloc(size_t size) {
+    void *ptr = arena ? arena_alloc(arena, size) : NULL;
+    return ptr ? ptr : malloc(size);
+}
+
+static void json_rpc_free(void *ptr) {
+    if (!arena_owns(arena, ptr)) {
+        free(ptr);
+    }
+}
+
+static void json_rpc_stats_handler(void *ctx, void *params, void **result) {
+    *result = params;
+}
+
+// {"method":{"calls":n,"errors":n,"hits":n,"time":{"parse":us,...}},...}
+static uint8_t json_rpc_stats_writer(void *result, json_rpc_writer_t *w) {
+    json_rpc_server_t *server = result;
+    json_rpc_write_object(w);
+    for (size_t i = 0; i < server->method_cnt; ++i) {
+        json_rpc_stats_t stats;
+        json_rpc_server_stats(server, server->method_index[i]->method, &stats);
+        json_rpc_write_key(w, server->method_index[i]->method);
+        json_rpc_write_object(w);
+        json_rpc_write_key(w, "calls");
+        json_rpc_write_int(w, stats.calls);
+        json_rpc_write_key(w, "errors");
+        json_rpc_write_int(w, stats.errors);
+        json_rpc_write_key(w, "hits");
+        json_rpc_write_int(w, stats.hits);
+        json_rpc_write_key(w, "time");
+        json_rpc_write_object(w);
+        for (int j = 0; j < JSON_RPC_PHASE_MAX; ++j) {
+            json_rpc_write_key(w, phase_names[j]);
+            json_rpc_write_int(w, stats.time[j]);
+        }
+        json_rpc_write_end(w);
+        json_rpc_write_end(w);
+    }
+    json_rpc_write_end(w);
+    return 0;
+}
@@ -0,0 +1,347 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "tokenizer.h"
+
+/***************************
+***** CONSTANTS ************
+***************************/
+
+#define MAX_DEPTH 64
+
+/***************************
+***** MACROS ***************
+***************************/
+
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+/***************************
+***** TYPES ****************
+***************************/
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static tok_type_t tok_type(char c);
+static const char *tok_space(const char *p);
+static const char *tok_key(const char *p);
+static const char *tok_skip_string(const char *p);
+static const char *tok_skip_number(const char *p);
+static const char *tok_skip_literal(const char *p, const char *literal);
+static int tok_hex(const char *p);
+static int tok_utf8(uint32_t c, char *out);
+
+/***************************
+***** LOCAL VARIABLES ******
+***************************/
+
+/***************************
+***** PUBLIC FUNCTIONS *****
+***************************/
+
+// checks the value at *pos including everything nested in it and moves *pos
+// behind it, open containers are tracked as one bit per level, so nothing is
+// allocated and nothing recurses
+bool tok_value(const char **pos, tok_t *tok) {
+    uint64_t array = 0;
+    int depth = 0;
+    const char *p = tok_space(*pos);
+    tok->start = p;
+    tok->type = tok_type(*p);
+    for (;;) {
+        bool done = true;
+        switch (*p) {
+            case '{':
+            case '[':
+                if (depth == MAX_DEPTH) {
+                    return false;
+                }
+                array = array << 1 | (*p == '[');
+                depth++;
+                p = tok_space(p + 1);
+                if (*p == (array & 1 ? ']' : '}')) {
+                    p++;
+                    array >>= 1;
+                    depth--;
+                } else {
+                    done = false;
+                    if (!(array & 1)) {
+                        p = tok_key(p);
+                    }
+                }
+                break;
+            case '"':
+                p = tok_skip_string(p);
+                break;
+            case 't':
+                p = tok_skip_literal(p, "true");
+                break;
+            case 'f':
+                p = tok_skip_literal(p, "false");
+                break;
+            case 'n':
+                p = tok_skip_literal(p, "null");
+                break;
+            default:
+                p = tok_skip_number(p);
+                break;
+        }
+        if (!p) {
+            return false;
+        }
+        // after a complete value close finished containers up to the next one
+        while (done) {
+            if (!depth) {
+                tok->len = p - tok->start;
+                *pos = p;
+                return true;
+            }
+            p = tok_space(p);
+            if (*p == ',') {
+                p = tok_space(p + 1);
+                if (!(array & 1) && !(p = tok_key(p))) {
+                    return false;
+                }
+                done = false;
+            } else if (*p == (array & 1 ? ']' : '}')) {
+                p++;
+                array >>= 1;
+                depth--;
+            } else {
+                return false;
+            }
+        }
+    }
+}
+
+bool tok_end(const char *pos) {
+    return !*tok_space(pos);
+}
+
+// the object must have passed tok_value, *pos starts out NULL
+bool tok_member(const tok_t *obj, const char **pos, tok_t *key, tok_t *val) {
+    const char *p = tok_space(*pos ? *pos : obj->start + 1);
+    if (*p == ',') {
+        p = tok_space(p + 1);
+    }
+    if (*p != '"' || !tok_value(&p, key)) {
+        return false;
+    }
+    p = tok_space(p) + 1;
+    if (!tok_value(&p, val)) {
+        return false;
+    }
+    *pos = p;
+    return true;
+}
+
+// the array must have passed tok_value, *pos starts out NULL
+bool tok_element(const tok_t *arr, const char **pos, tok_t *val) {
+    const char *p = tok_space(*pos ? *pos : arr->start + 1);
+    if (*p == ',') {
+        p = tok_space(p + 1);
+    }
+    if (*p == ']' || !tok_value(&p, val)) {
+        return false;
+    }
+    *pos = p;
+    return true;
+}
+
+// unescapes a string token into buf, returns size if it does not fit or
+// holds an escaped NUL or an unpaired surrogate
+size_t tok_string(const tok_t *tok, char *buf, size_t size) {
+    size_t len = 0;
+    const char *p = tok->start + 1;
+    const char *end = tok->start + tok->len - 1;
+    while (p < end) {
+        uint32_t c = (unsigned char)*p++;
+        char utf8[4] = { c };
+        int n = 1;
+        if (c == '\\') {
+            switch (c = *p++) {
+                case 'b':
+                    c = '\b';
+                    break;
+                case 'f':
+                    c = '\f';
+                    break;
+                case 'n':
+                    c = '\n';
+                    break;
+                case 'r':
+                    c = '\r';
+                    break;
+                case 't':
+                    c = '\t';
+                    break;
+                case 'u':
+                    c = tok_hex(p);
+                    p += 4;
+                    if (c >= 0xD800 && c < 0xDC00 && p[0] == '\\' && p[1] == 'u') {
+                        int low = tok_hex(p + 2);
+                        if (low >= 0xDC00 && low < 0xE000) {
+                            c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                            p += 6;
+                        }
+                    }
+                    break;
+                default:
+                    break;
+            }
+            // NUL would cut the string short, cJSON rejects lone surrogates too
+            if (!c || (c >= 0xD800 && c < 0xE000)) {
+                return size;
+            }
+            n = tok_utf8(c, utf8);
+        }
+        if (len + n >= size) {
+            return size;
+        }
+        memcpy(buf + len, utf8, n);
+        len += n;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static tok_type_t tok_type(char c) {
+    switch (c) {
+        case '{':
+            return TOK_OBJECT;
+        case '[':
+            return TOK_ARRAY;
+        case '"':
+            return TOK_STRING;
+        case 't':
+            return TOK_TRUE;
+        case 'f':
+            return TOK_FALSE;
+        case 'n':
+            return TOK_NULL;
+        default:
+            return TOK_NUMBER;
+    }
+}
+
+static const char *tok_space(const char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+        p++;
+    }
+    return p;
+}
+
+// skips an object key and its colon
+static const char *tok_key(const char *p) {
+    if (*p != '"' || !(p = tok_skip_string(p))) {
+        return NULL;
+    }
+    p = tok_space(p);
+    return *p == ':' ? tok_space(p + 1) : NULL;
+}
+
+static const char *tok_skip_string(const char *p) {
+    for (p++; *p != '"'; p++) {
+        if ((unsigned char)*p < 0x20) {
+            return NULL;
+        }
+        if (*p == '\\') {
+            p++;
+            if (*p == 'u') {
+                if (tok_hex(p + 1) < 0) {
+                    return NULL;
+                }
+                p += 4;
+            } else if (!*p || !strchr("\"\\/bfnrt", *p)) {
+                return NULL;
+            }
+        }
+    }
+    return p + 1;
+}
+
+static const char *tok_skip_number(const char *p) {
+    if (*p == '-') {
+        p++;
+    }
+    if (*p == '0') {
+        p++;
+    } else if (IS_DIGIT(*p)) {
+        while (IS_DIGIT(*p)) {
+            p++;
+        }
+    } else {
+        return NULL;
+    }
+    if (*p == '.') {
+        p++;
+        if (!IS_DIGIT(*p)) {
+            return NULL;
+        }
+        while (IS_DIGIT(*p)) {
+            p++;
+        }
+    }
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        if (*p == '+' || *p == '-') {
+            p++;
+        }
+        if (!IS_DIGIT(*p)) {
+            return NULL;
+        }
+        while (IS_DIGIT(*p)) {
+            p++;
+        }
+    }
+    return p;
+}
+
+static const char *tok_skip_literal(const char *p, const char *literal) {
+    size_t len = strlen(literal);
+    return strncmp(p, literal, len) ? NULL : p + len;
+}
+
+static int tok_hex(const char *p) {
+    int value = 0;
+    for (int i = 0; i < 4; ++i) {
+        char c = p[i];
+        value <<= 4;
+        if (IS_DIGIT(c)) {
+            value |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            value |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            value |= c - 'A' + 10;
+        } else {
+            return -1;
+        }
+    }
+    return value;
+}
+
+static int tok_utf8(uint32_t c, char *out) {
+    if (c < 0x80) {
+        out[0] = c;
+        return 1;
+    } else if (c < 0x800) {
+        out[0] = 0xC0 | (c >> 6);
+        out[1] = 0x80 | (c & 0x3F);
+        return 2;
+    } else if (c < 0x10000) {
+        out[0] = 0xE0 | (c >> 12);
+        out[1] = 0x80 | ((c >> 6) & 0x3F);
+        out[2] = 0x80 | (c & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (c >> 18);
+    out[1] = 0x80 | ((c >> 12) & 0x3F);
+    out[2] = 0x80 | ((c >> 6) & 0x3F);
+    out[3] = 0x80 | (c & 0x3F);
+    return 4;
+}
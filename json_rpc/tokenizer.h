@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    TOK_NONE,
+    TOK_OBJECT,
+    TOK_ARRAY,
+    TOK_STRING,
+    TOK_NUMBER,
+    TOK_TRUE,
+    TOK_FALSE,
+    TOK_NULL
+} tok_type_t;
+
+// a value in the request buffer, start and len cover quotes and brackets
+typedef struct {
+    tok_type_t type;
+    const char *start;
+    size_t     len;
+} tok_t;
+
+bool   tok_value(const char **pos, tok_t *tok);
+bool   tok_end(const char *pos);
+bool   tok_member(const tok_t *obj, const char **pos, tok_t *key, tok_t *val);
+bool   tok_element(const tok_t *arr, const char **pos, tok_t *val);
+size_t tok_string(const tok_t *tok, char *buf, size_t size);
@@ -0,0 +1,376 @@
+#include <assert.h>
+#include <float.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "writer.h"
+
+/***************************
+***** CONSTANTS ************
+***************************/
+
+#define BUFFER_SIZE 256
+#define MAX_DEPTH   64
+
+#define CBOR_UINT   0
+#define CBOR_NINT   1
+#define CBOR_BYTES  2
+#define CBOR_TEXT   3
+#define CBOR_FALSE  0xF4
+#define CBOR_TRUE   0xF5
+#define CBOR_NULL   0xF6
+#define CBOR_FLOAT  0xFA
+#define CBOR_DOUBLE 0xFB
+#define CBOR_ARRAY  0x9F
+#define CBOR_MAP    0xBF
+#define CBOR_BREAK  0xFF
+
+/***************************
+***** MACROS ***************
+***************************/
+
+/***************************
+***** TYPES ****************
+***************************/
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static void writer_put(json_rpc_writer_t *w, const char *data, size_t len);
+static void writer_byte(json_rpc_writer_t *w, uint8_t byte);
+static void writer_head(json_rpc_writer_t *w, uint8_t major, uint64_t arg);
+static void writer_float(json_rpc_writer_t *w, uint8_t type, uint64_t bits, int n);
+static void writer_separate(json_rpc_writer_t *w);
+static void writer_open(json_rpc_writer_t *w, bool array);
+static void writer_quoted(json_rpc_writer_t *w, const char *str);
+
+/***************************
+***** LOCAL VARIABLES ******
+***************************/
+
+/***************************
+***** PUBLIC FUNCTIONS *****
+***************************/
+
+void writer_init(json_rpc_writer_t *w, bool cbor) {
+    memset(w, 0, sizeof(json_rpc_writer_t));
+    w->cbor = cbor;
+    w->buf = malloc(BUFFER_SIZE);
+    w->size = BUFFER_SIZE;
+    w->failed = !w->buf;
+}
+
+// a writer that drops everything
+void writer_null(json_rpc_writer_t *w) {
+    memset(w, 0, sizeof(json_rpc_writer_t));
+    w->failed = true;
+}
+
+// writes a tree from a legacy result builder, numbers are printed like cJSON does
+void writer_json(json_rpc_writer_t *w, const cJSON *json) {
+    if (!json || cJSON_IsNull(json)) {
+        json_rpc_write_null(w);
+    } else if (cJSON_IsBool(json)) {
+        json_rpc_write_bool(w, cJSON_IsTrue(json));
+    } else if (cJSON_IsNumber(json)) {
+        if (json->valuedouble == json->valueint) {
+            json_rpc_write_int(w, json->valueint);
+        } else {
+            json_rpc_write_double(w, json->valuedouble);
+        }
+    } else if (cJSON_IsString(json)) {
+        json_rpc_write_string(w, json->valuestring);
+    } else if (cJSON_IsRaw(json) && w->cbor) {
+        json_rpc_write_string(w, json->valuestring);
+    } else if (cJSON_IsRaw(json)) {
+        writer_raw(w, json->valuestring, strlen(json->valuestring));
+    } else if (cJSON_IsArray(json) || cJSON_IsObject(json)) {
+        bool object = cJSON_IsObject(json);
+        if (object) {
+            json_rpc_write_object(w);
+        } else {
+            json_rpc_write_array(w);
+        }
+        const cJSON *item;
+        cJSON_ArrayForEach(item, json) {
+            if (object) {
+                json_rpc_write_key(w, item->string);
+            }
+            writer_json(w, item);
+        }
+        json_rpc_write_end(w);
+    }
+}
+
+// a complete value that is already in the encoding of the writer
+void writer_raw(json_rpc_writer_t *w, const char *data, size_t len) {
+    writer_separate(w);
+    writer_put(w, data, len);
+}
+
+// drops everything written since mark was copied from w
+void writer_rewind(json_rpc_writer_t *w, const json_rpc_writer_t *mark) {
+    w->len = mark->len;
+    w->key = mark->key;
+    w->depth = mark->depth;
+    w->array = mark->array;
+    w->empty = mark->empty;
+}
+
+// hands over the buffer, NULL if memory ran out on the way, JSON gets
+// terminated, len stays the length without the terminator
+char *writer_finish(json_rpc_writer_t *w) {
+    assert(!w->depth);
+    if (!w->cbor) {
+        writer_put(w, "", 1);
+        w->len--;
+    }
+    if (w->failed) {
+        writer_free(w);
+    }
+    return w->buf;
+}
+
+void writer_free(json_rpc_writer_t *w) {
+    free(w->buf);
+    w->buf = NULL;
+}
+
+void json_rpc_write_object(json_rpc_writer_t *w) {
+    writer_open(w, false);
+}
+
+void json_rpc_write_array(json_rpc_writer_t *w) {
+    writer_open(w, true);
+}
+
+void json_rpc_write_end(json_rpc_writer_t *w) {
+    assert(w->depth && !w->key);
+    if (w->cbor) {
+        writer_byte(w, CBOR_BREAK);
+    } else {
+        writer_put(w, w->array & 1 ? "]" : "}", 1);
+    }
+    w->array >>= 1;
+    w->empty >>= 1;
+    w->depth--;
+}
+
+void json_rpc_write_key(json_rpc_writer_t *w, const char *key) {
+    assert(w->depth && !(w->array & 1) && !w->key);
+    json_rpc_write_string(w, key);
+    if (!w->cbor) {
+        writer_put(w, ":", 1);
+    }
+    w->key = true;
+}
+
+void json_rpc_write_string(json_rpc_writer_t *w, const char *str) {
+    writer_separate(w);
+    if (w->cbor) {
+        size_t len = strlen(str);
+        writer_head(w, CBOR_TEXT, len);
+        writer_put(w, str, len);
+    } else {
+        writer_quoted(w, str);
+    }
+}
+
+// raw bytes in CBOR, a hex string in JSON
+void json_rpc_write_bytes(json_rpc_writer_t *w, const uint8_t *data, size_t len) {
+    writer_separate(w);
+    if (w->cbor) {
+        writer_head(w, CBOR_BYTES, len);
+        writer_put(w, (const char *)data, len);
+        return;
+    }
+    writer_put(w, "\"", 1);
+    for (size_t i = 0; i < len; ++i) {
+        char hex[2] = { "0123456789abcdef"[data[i] >> 4], "0123456789abcdef"[data[i] & 0xF] };
+        writer_put(w, hex, 2);
+    }
+    writer_put(w, "\"", 1);
+}
+
+void json_rpc_write_int(json_rpc_writer_t *w, int64_t value) {
+    char num[24];
+    writer_separate(w);
+    if (w->cbor) {
+        if (value < 0) {
+            writer_head(w, CBOR_NINT, -1 - value);
+        } else {
+            writer_head(w, CBOR_UINT, value);
+        }
+        return;
+    }
+    writer_put(w, num, snprintf(num, sizeof(num), "%" PRId64, value));
+}
+
+void json_rpc_write_double(json_rpc_writer_t *w, double value) {
+    char num[32];
+    writer_separate(w);
+    if (w->cbor) {
+        // single precision whenever it is exact, the range is checked first
+        // as converting a double beyond it is undefined
+        if (value >= -FLT_MAX && value <= FLT_MAX && (float)value == value) {
+            float f = value;
+            uint32_t bits;
+            memcpy(&bits, &f, sizeof(bits));
+            writer_float(w, CBOR_FLOAT, bits, sizeof(bits));
+        } else {
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            writer_float(w, CBOR_DOUBLE, bits, sizeof(bits));
+        }
+        return;
+    }
+    if (value * 0 != 0) {
+        // nan and infinity have no JSON representation
+        writer_put(w, "null", 4);
+        return;
+    }
+    int len = snprintf(num, sizeof(num), "%1.15g", value);
+    if (strtod(num, NULL) != value) {
+        len = snprintf(num, sizeof(num), "%1.17g", value);
+    }
+    writer_put(w, num, len);
+}
+
+void json_rpc_write_bool(json_rpc_writer_t *w, bool value) {
+    writer_separate(w);
+    if (w->cbor) {
+        writer_byte(w, value ? CBOR_TRUE : CBOR_FALSE);
+    } else if (value) {
+        writer_put(w, "true", 4);
+    } else {
+        writer_put(w, "false", 5);
+    }
+}
+
+void json_rpc_write_null(json_rpc_writer_t *w) {
+    writer_separate(w);
+    if (w->cbor) {
+        writer_byte(w, CBOR_NULL);
+    } else {
+        writer_put(w, "null", 4);
+    }
+}
+
+/***************************
+***** LOCAL FUNCTIONS ******
+***************************/
+
+static void writer_put(json_rpc_writer_t *w, const char *data, size_t len) {
+    if (w->failed) {
+        return;
+    }
+    if (w->len + len > w->size) {
+        size_t size = w->size;
+        while (w->len + len > size) {
+            size *= 2;
+        }
+        char *buf = realloc(w->buf, size);
+        if (!buf) {
+            w->failed = true;
+            return;
+        }
+        w->buf = buf;
+        w->size = size;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+static void writer_byte(json_rpc_writer_t *w, uint8_t byte) {
+    writer_put(w, (const char *)&byte, 1);
+}
+
+// the shortest CBOR head for the argument
+static void writer_head(json_rpc_writer_t *w, uint8_t major, uint64_t arg) {
+    uint8_t head[9];
+    int n = arg < 24 ? 0 : arg <= 0xFF ? 1 : arg <= 0xFFFF ? 2 : arg <= 0xFFFFFFFF ? 4 : 8;
+    head[0] = major << 5 | (n == 0 ? arg : n == 1 ? 24 : n == 2 ? 25 : n == 4 ? 26 : 27);
+    for (int i = n; i > 0; --i) {
+        head[i] = arg;
+        arg >>= 8;
+    }
+    writer_put(w, (const char *)head, n + 1);
+}
+
+static void writer_float(json_rpc_writer_t *w, uint8_t type, uint64_t bits, int n) {
+    uint8_t buf[9] = { type };
+    for (int i = n; i > 0; --i) {
+        buf[i] = bits;
+        bits >>= 8;
+    }
+    writer_put(w, (const char *)buf, n + 1);
+}
+
+// a value right after its key needs no comma, neither does the first one in a container
+static void writer_separate(json_rpc_writer_t *w) {
+    if (w->key) {
+        w->key = false;
+    } else if (w->empty & 1) {
+        w->empty &= ~1ULL;
+    } else if (w->depth && !w->cbor) {
+        writer_put(w, ",", 1);
+    }
+}
+
+static void writer_open(json_rpc_writer_t *w, bool array) {
+    assert(w->depth < MAX_DEPTH);
+    writer_separate(w);
+    if (w->cbor) {
+        writer_byte(w, array ? CBOR_ARRAY : CBOR_MAP);
+    } else {
+        writer_put(w, array ? "[" : "{", 1);
+    }
+    w->array = w->array << 1 | array;
+    w->empty = w->empty << 1 | 1;
+    w->depth++;
+}
+
+static void writer_quoted(json_rpc_writer_t *w, const char *str) {
+    writer_put(w, "\"", 1);
+    const char *run = str;
+    for (; *str; str++) {
+        unsigned char c = *str;
+        char esc[7] = { '\\', 0 };
+        switch (c) {
+            case '"':
+            case '\\':
+                esc[1] = c;
+                break;
+            case '\b':
+                esc[1] = 'b';
+                break;
+            case '\f':
+                esc[1] = 'f';
+                break;
+            case '\n':
+                esc[1] = 'n';
+                break;
+            case '\r':
+                esc[1] = 'r';
+                break;
+            case '\t':
+                esc[1] = 't';
+                break;
+            default:
+                if (c < 0x20) {
+                    snprintf(esc, sizeof(esc), "\\u%04x", c);
+                }
+                break;
+        }
+        if (esc[1]) {
+            writer_put(w, run, str - run);
+            writer_put(w, esc, strlen(esc));
+            run = str + 1;
+        }
+    }
+    writer_put(w, run, str - run);
+    writer_put(w, "\"", 1);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cJSON.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "json_rpc.h"
+
+// array and empty hold one bit per open container, the lowest is the innermost,
+// with cbor set containers are written with indefinite length
+struct json_rpc_writer {
+    bool     cbor;
+    char     *buf;
+    size_t   len;
+    size_t   size;
+    bool     failed;
+    bool     key;
+    int      depth;
+    uint64_t array;
+    uint64_t empty;
+};
+
+void  writer_init(json_rpc_writer_t *w, bool cbor);
+void  writer_null(json_rpc_writer_t *w);
+void  writer_json(json_rpc_writer_t *w, const cJSON *json);
+void  writer_raw(json_rpc_writer_t *w, const char *data, size_t len);
+void  writer_rewind(json_rpc_writer_t *w, const json_rpc_writer_t *mark);
+char *writer_finish(json_rpc_writer_t *w);
+void  writer_free(json_rpc_writer_t *w);
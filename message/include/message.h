@@ -1,11 +1,16 @@
 #pragma once
 
+#include <freertos/FreeRTOS.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /********************
 ***** CONSTANTS *****
 ********************/
 
+#define MSG_LATENCY_BUCKETS 16
+
 /********************
 ***** MACROS ********
 ********************/
@@ -15,29 +20,84 @@
 ********************/
 
 typedef uint8_t msg_handle_t;
-typedef uint8_t msg_type_t;
+typedef uint16_t msg_type_t;
 
 typedef void (*msg_free_t)(void *ptr);
 
+typedef enum {
+    MSG_DROP_NEWEST,
+    MSG_DROP_OLDEST,
+    MSG_BLOCK,
+    MSG_COALESCE,
+} msg_policy_t;
+
+typedef enum {
+    MSG_PRIO_BULK,
+    MSG_PRIO_URGENT,
+    MSG_PRIO_MAX
+} msg_prio_t;
+
+typedef struct {
+    msg_policy_t policy;
+    uint32_t     timeout_ms;
+    msg_prio_t   prio;
+} msg_listen_cfg_t;
+
+typedef struct {
+    uint16_t size;
+    uint16_t blocks;
+    uint16_t used;
+    uint16_t peak;
+    uint32_t failed;
+} msg_pool_stats_t;
+
+// latency[i] counts messages that waited less than 2^(i+1) us in the queue,
+// the last bucket takes everything above
+typedef struct {
+    uint16_t depth;
+    uint16_t high_water;
+    uint32_t received;
+    uint32_t dropped;
+    uint32_t latency[MSG_LATENCY_BUCKETS];
+} msg_handle_stats_t;
+
 typedef struct {
     msg_type_t type;
+    bool       is_ptr;
     union {
         uint32_t value;
-        struct {
-            void *ptr;
-            msg_free_t free;
-        };
+        void     *ptr;
     };
 } msg_t;
 
+typedef void (*msg_callback_t)(void *ctx, const msg_t *msg);
+
 /********************
 ***** FUNCTIONS *****
 ********************/
 
 void            msg_init(void);
 msg_type_t      msg_register(void);
-msg_handle_t    msg_listen(msg_type_t msg_types);
+msg_type_t      msg_register_conflated(void);
+msg_handle_t    msg_listen(msg_type_t msg_type);
+msg_handle_t    msg_listen_cfg(msg_type_t msg_type, const msg_listen_cfg_t *cfg);
+void            msg_listen_add(msg_handle_t handle, msg_type_t msg_type, msg_prio_t prio);
+msg_handle_t    msg_subscribe(msg_type_t msg_type, msg_callback_t callback, void *ctx);
 void            msg_send_value(msg_type_t msg_type, uint32_t value);
-void            msg_send_ptr(msg_type_t msg_type, void *ptr, msg_free_t free);
+void            msg_send_value_from_isr(msg_type_t msg_type, uint32_t value, BaseType_t *woken);
+void           *msg_alloc(size_t size, msg_free_t free);
+void            msg_release(void *ptr);
+void            msg_send_ptr(msg_type_t msg_type, void *ptr);
 void            msg_free(msg_t *msg);
+bool            msg_latest(msg_type_t msg_type, uint32_t *value);
+// a handle has a single consumer, a second task receiving on it at the same
+// time trips an assert; a receiving task sleeps on task notification index
+// CONFIG_MSG_NOTIFY_INDEX, which the application must not use for anything
+// else, its default notification stays untouched
 msg_t           msg_receive(msg_handle_t);
+size_t          msg_receive_batch(msg_handle_t handle, msg_t *msgs, size_t max, uint32_t timeout_ms);
+bool            msg_receive_any(const msg_handle_t *handles, size_t cnt, msg_handle_t *from, msg_t *msg, uint32_t timeout_ms);
+uint32_t        msg_dropped(msg_handle_t handle);
+size_t          msg_pool_stats(msg_pool_stats_t *stats, size_t max);
+bool            msg_stats_type(msg_type_t type, uint32_t *published);
+bool            msg_stats_handle(msg_handle_t handle, msg_handle_stats_t *stats);
@@ -1,5 +1,12 @@
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
 
 #include "message.h"
 
@@ -7,8 +14,35 @@
 ***** CONSTANTS ************
 ***************************/
 
-#define MAX_HANDLES     20
-#define MAX_MESSAGES    20
+#define TASK_PRIO       1
+
+#define MAX_HANDLES     CONFIG_MSG_MAX_HANDLES
+#define MAX_MESSAGES    CONFIG_MSG_QUEUE_LENGTH
+#define MAX_URGENT      CONFIG_MSG_URGENT_LENGTH
+
+_Static_assert(MAX_MESSAGES && (MAX_MESSAGES & (MAX_MESSAGES - 1)) == 0, "MAX_MESSAGES must be a power of two");
+_Static_assert(MAX_URGENT && (MAX_URGENT & (MAX_URGENT - 1)) == 0, "MAX_URGENT must be a power of two");
+
+#define NOTIFY_INDEX    CONFIG_MSG_NOTIFY_INDEX
+
+_Static_assert(NOTIFY_INDEX < configTASK_NOTIFICATION_ARRAY_ENTRIES, "FREERTOS_TASK_NOTIFICATION_ARRAY_ENTRIES must exceed MSG_NOTIFY_INDEX");
+
+#define POOL_MAP_WORDS  4
+#define POOL_HEAP       0xFF
+
+#ifdef CONFIG_MSG_STATS
+#define STATS           1
+#else
+#define STATS           0
+#endif
+
+#define HEAP_CAPS       (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+
+#ifdef CONFIG_MSG_POOL_SPIRAM
+#define POOL_CAPS       MALLOC_CAP_SPIRAM
+#else
+#define POOL_CAPS       HEAP_CAPS
+#endif
 
 /***************************
 ***** MACROS ***************
@@ -25,93 +59,827 @@
 ***** TYPES ****************
 ***************************/
 
+// one slot of a bounded lock-free ring (Vyukov): seq tells producers and
+// consumers whether the slot is free or holds a message for a given position
+typedef struct {
+    atomic_uint seq;
+    uint32_t stamp;
+    msg_t msg;
+} slot_t;
+
+typedef struct {
+    slot_t *slot;
+    unsigned int size;
+    atomic_uint head;
+    atomic_uint tail;
+} ring_t;
+
+// one ring per priority, msg_receive always empties the urgent one first
 typedef struct {
-    msg_type_t types;
-    QueueHandle_t queue;
+    ring_t ring[MSG_PRIO_MAX];
+    _Atomic(TaskHandle_t) waiter;
+    msg_policy_t policy;
+    TickType_t timeout;
+    SemaphoreHandle_t space;
+    atomic_uint blocked;
+    atomic_uint dropped;
+    atomic_uint high_water;
+    atomic_uint received;
+    atomic_uint latency[MSG_LATENCY_BUCKETS];
+    msg_callback_t callback;
+    void *ctx;
+    atomic_bool scheduled;
 } receiver_t;
 
+// subscriptions are only ever prepended, so senders can walk the list without a lock
+typedef struct subscription {
+    msg_handle_t handle;
+    msg_prio_t prio;
+    struct subscription *next;
+    portMUX_TYPE lock;
+    bool pending;
+    msg_t latest;
+} subscription_t;
+
+// a conflated topic remembers its latest value and delivers to every
+// subscription in coalescing mode, whatever the policy of the handle
+typedef struct {
+    _Atomic(subscription_t *) first;
+    atomic_uint published;
+    bool conflate;
+    portMUX_TYPE lock;
+    bool valid;
+    uint32_t latest;
+} topic_t;
+
+// header in front of every payload from msg_alloc, each queued copy of a
+// pointer message owns one reference; atomics don't work on PSRAM, so only
+// heap payloads count in refs, pooled ones in the refs table of their pool
+typedef union {
+    struct {
+        atomic_uint refs;
+        msg_free_t free;
+        uint8_t pool;
+    };
+    max_align_t align;
+} payload_t;
+
+// a slab of equally sized blocks, a set bit in map marks a block in use
+typedef struct {
+    uint16_t size;
+    uint16_t blocks;
+    uint8_t *mem;
+    atomic_uint *refs;
+    atomic_uint map[POOL_MAP_WORDS];
+    atomic_uint used;
+    atomic_uint peak;
+    atomic_uint failed;
+} pool_t;
+
 /***************************
 ***** LOCAL FUNCTIONS ******
 ***************************/
 
+static msg_handle_t msg_create(const msg_listen_cfg_t *cfg, msg_callback_t callback, void *ctx);
+static void msg_send(const msg_t *msg, BaseType_t *woken);
+static void msg_send_conflated(topic_t *tp, const msg_t *msg, BaseType_t *woken);
+static void msg_wake(receiver_t *rcv, BaseType_t *woken);
+static void msg_dispatch_task(void *param);
+static bool msg_pending(receiver_t *rcv);
+static bool msg_deliver(receiver_t *rcv, subscription_t *sub, const msg_t *msg, BaseType_t *woken);
+static bool msg_push_wait(receiver_t *rcv, msg_prio_t prio, const msg_t *msg);
+static bool msg_coalesce(receiver_t *rcv, subscription_t *sub, const msg_t *msg, bool isr);
+static int  msg_wait(const msg_handle_t *handles, size_t cnt, msg_t *msg, TickType_t ticks);
+static bool msg_take(receiver_t *rcv, msg_t *msg);
+static void msg_resolve(receiver_t *rcv, msg_t *msg);
+static void msg_discard(receiver_t *rcv, msg_t *msg);
+static void msg_retain(void *ptr);
+static atomic_uint *msg_refs(payload_t *payload);
+static TickType_t msg_ticks(uint32_t ms);
+static payload_t *msg_pool_alloc(pool_t *p);
+static void msg_pool_free(pool_t *p, payload_t *payload);
+static void msg_peak(atomic_uint *peak, unsigned int value);
+static bool msg_push(receiver_t *rcv, msg_prio_t prio, const msg_t *msg);
+static bool msg_pop(receiver_t *rcv, msg_prio_t prio, msg_t *msg, uint32_t *stamp);
+
 /***************************
 ***** LOCAL VARIABLES ******
 ***************************/
 
 static receiver_t receiver[MAX_HANDLES];
-static uint8_t next_type;
-static msg_handle_t next_handle;
+static topic_t topic[CONFIG_MSG_MAX_TYPES];
+static atomic_uint next_type;
+static atomic_uint next_handle;
 static SemaphoreHandle_t mutex;
+static QueueHandle_t dispatch;
+static pool_t pool[] = {
+    { .size = 64,   .blocks = CONFIG_MSG_POOL_SMALL_BLOCKS  },
+    { .size = 256,  .blocks = CONFIG_MSG_POOL_MEDIUM_BLOCKS },
+    { .size = 1024, .blocks = CONFIG_MSG_POOL_LARGE_BLOCKS  },
+};
+
+#ifdef CONFIG_MSG_STATIC
+// everything the bus needs lives in .bss, idf.py size-components reports it
+static slot_t bulk_slot[MAX_HANDLES][MAX_MESSAGES];
+static slot_t urgent_slot[MAX_HANDLES][MAX_URGENT];
+static StaticSemaphore_t space_buf[MAX_HANDLES];
+static subscription_t sub_buf[CONFIG_MSG_MAX_SUBSCRIPTIONS];
+static unsigned int next_sub;
+static StaticSemaphore_t mutex_buf;
+static StaticQueue_t dispatch_buf;
+static uint8_t dispatch_storage[MAX_HANDLES * sizeof(msg_handle_t)];
+static StaticTask_t dispatch_task[portNUM_PROCESSORS];
+static StackType_t dispatch_stack[portNUM_PROCESSORS][CONFIG_MSG_DISPATCH_STACK_SIZE];
+static _Alignas(payload_t) uint8_t pool_small[64 * CONFIG_MSG_POOL_SMALL_BLOCKS];
+static _Alignas(payload_t) uint8_t pool_medium[256 * CONFIG_MSG_POOL_MEDIUM_BLOCKS];
+static _Alignas(payload_t) uint8_t pool_large[1024 * CONFIG_MSG_POOL_LARGE_BLOCKS];
+static atomic_uint refs_small[CONFIG_MSG_POOL_SMALL_BLOCKS];
+static atomic_uint refs_medium[CONFIG_MSG_POOL_MEDIUM_BLOCKS];
+static atomic_uint refs_large[CONFIG_MSG_POOL_LARGE_BLOCKS];
+#endif
 
 /***************************
 ***** PUBLIC FUNCTIONS *****
 ***************************/
 
 void msg_init(void) {
+#ifdef CONFIG_MSG_STATIC
+    mutex = xSemaphoreCreateMutexStatic(&mutex_buf);
+    pool[0].mem = pool_small;
+    pool[1].mem = pool_medium;
+    pool[2].mem = pool_large;
+    pool[0].refs = refs_small;
+    pool[1].refs = refs_medium;
+    pool[2].refs = refs_large;
+    LOGI("static bus memory %u bytes", (unsigned int)(sizeof(receiver) + sizeof(topic) + sizeof(bulk_slot) + sizeof(urgent_slot) + sizeof(space_buf)
+        + sizeof(sub_buf) + sizeof(mutex_buf) + sizeof(dispatch_buf) + sizeof(dispatch_storage) + sizeof(dispatch_task) + sizeof(dispatch_stack)
+        + sizeof(pool_small) + sizeof(pool_medium) + sizeof(pool_large) + sizeof(refs_small) + sizeof(refs_medium) + sizeof(refs_large)));
+#else
     mutex = xSemaphoreCreateMutex();
+    for (int i = 0; i < sizeof(pool)/sizeof(pool_t); ++i) {
+        if (pool[i].blocks) {
+            pool[i].mem = heap_caps_aligned_alloc(_Alignof(payload_t), pool[i].size * pool[i].blocks, POOL_CAPS);
+            pool[i].refs = heap_caps_calloc(pool[i].blocks, sizeof(atomic_uint), HEAP_CAPS);
+            assert(pool[i].mem && pool[i].refs);
+        }
+    }
+#endif
+    for (int i = 0; i < sizeof(pool)/sizeof(pool_t); ++i) {
+        assert(pool[i].blocks <= POOL_MAP_WORDS * 32);
+    }
 }
 
 msg_type_t msg_register(void) {
-    assert(next_type < sizeof(msg_type_t) * 8);
-    msg_type_t type = 1 << next_type++;
+    msg_type_t type = atomic_fetch_add(&next_type, 1) + 1;
+    assert(type <= CONFIG_MSG_MAX_TYPES);
+    return type;
+}
+
+msg_type_t msg_register_conflated(void) {
+    msg_type_t type = msg_register();
+    topic_t *tp = &topic[type - 1];
+    portMUX_INITIALIZE(&tp->lock);
+    tp->conflate = true;
     return type;
 }
 
-msg_handle_t msg_listen(msg_type_t msg_types) {
+msg_handle_t msg_listen(msg_type_t msg_type) {
+    return msg_listen_cfg(msg_type, NULL);
+}
+
+msg_handle_t msg_listen_cfg(msg_type_t msg_type, const msg_listen_cfg_t *cfg) {
+    msg_handle_t handle = msg_create(cfg, NULL, NULL);
+    msg_listen_add(handle, msg_type, cfg ? cfg->prio : MSG_PRIO_BULK);
+    return handle;
+}
+
+void msg_listen_add(msg_handle_t handle, msg_type_t msg_type, msg_prio_t prio) {
+    assert(msg_type && msg_type <= atomic_load(&next_type));
+    assert(prio < MSG_PRIO_MAX);
+    topic_t *tp = &topic[msg_type - 1];
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    assert(handle < atomic_load(&next_handle));
+    for (subscription_t *sub = atomic_load(&tp->first); sub; sub = sub->next) {
+        assert(sub->handle != handle);
+    }
+#ifdef CONFIG_MSG_STATIC
+    assert(next_sub < CONFIG_MSG_MAX_SUBSCRIPTIONS);
+    subscription_t *sub = &sub_buf[next_sub++];
+#else
+    subscription_t *sub = calloc(1, sizeof(subscription_t));
+    assert(sub);
+#endif
+    sub->handle = handle;
+    sub->prio = prio;
+    portMUX_INITIALIZE(&sub->lock);
+    sub->next = atomic_load(&tp->first);
+    atomic_store_explicit(&tp->first, sub, memory_order_release);
+    if (tp->conflate) {
+        // a late subscriber gets the current value right away
+        receiver_t *rcv = &receiver[handle];
+        msg_t msg = {
+            .type = msg_type
+        };
+        portENTER_CRITICAL(&tp->lock);
+        bool valid = tp->valid;
+        if (valid) {
+            msg.value = tp->latest;
+            msg_coalesce(rcv, sub, &msg, false);
+        }
+        portEXIT_CRITICAL(&tp->lock);
+        if (valid) {
+            msg_wake(rcv, NULL);
+        }
+    }
+    xSemaphoreGive(mutex);
+}
+
+msg_handle_t msg_subscribe(msg_type_t msg_type, msg_callback_t callback, void *ctx) {
+    assert(callback);
     xSemaphoreTake(mutex, portMAX_DELAY);
-    assert(next_handle < MAX_HANDLES);
-    msg_handle_t handle = next_handle++;
-    receiver[handle].types = msg_types;
-    receiver[handle].queue = xQueueCreate(MAX_MESSAGES, sizeof(msg_t));
+    if (!dispatch) {
+#ifdef CONFIG_MSG_STATIC
+        dispatch = xQueueCreateStatic(MAX_HANDLES, sizeof(msg_handle_t), dispatch_storage, &dispatch_buf);
+        for (int core = 0; core < portNUM_PROCESSORS; ++core) {
+            xTaskCreateStaticPinnedToCore(&msg_dispatch_task, "msg-dispatch", CONFIG_MSG_DISPATCH_STACK_SIZE, NULL, TASK_PRIO, dispatch_stack[core], &dispatch_task[core], core);
+        }
+#else
+        dispatch = xQueueCreate(MAX_HANDLES, sizeof(msg_handle_t));
+        assert(dispatch);
+        for (int core = 0; core < portNUM_PROCESSORS; ++core) {
+            if (xTaskCreatePinnedToCore(&msg_dispatch_task, "msg-dispatch", CONFIG_MSG_DISPATCH_STACK_SIZE, NULL, TASK_PRIO, NULL, core) != pdPASS) {
+                LOGE("could not create task");
+            }
+        }
+#endif
+    }
     xSemaphoreGive(mutex);
+    msg_handle_t handle = msg_create(NULL, callback, ctx);
+    msg_listen_add(handle, msg_type, MSG_PRIO_BULK);
     return handle;
 }
 
 void msg_send_value(msg_type_t msg_type, uint32_t value) {
-    xSemaphoreTake(mutex, portMAX_DELAY);
     msg_t msg = {
         .type = msg_type,
         .value = value
     };
-    for (int i = 0; i < next_handle; ++i) {
-        if (receiver[i].types & msg_type) {
-            assert(xQueueSendToBack(receiver[i].queue, &msg, 0) == pdPASS);
-        }
-    }
-    xSemaphoreGive(mutex);
+    msg_send(&msg, NULL);
 }
 
-void msg_send_ptr(msg_type_t msg_type, void *ptr, msg_free_t free) {
-    xSemaphoreTake(mutex, portMAX_DELAY);
+void msg_send_value_from_isr(msg_type_t msg_type, uint32_t value, BaseType_t *woken) {
+    assert(woken);
     msg_t msg = {
         .type = msg_type,
-        .ptr = ptr,
-        .free = free
+        .value = value
     };
-    for (int i = 0; i < next_handle; ++i) {
-        if (receiver[i].types & msg_type) {
-            assert(xQueueSendToBack(receiver[i].queue, &msg, 0) == pdPASS);
+    msg_send(&msg, woken);
+}
+
+void *msg_alloc(size_t size, msg_free_t free) {
+    size += sizeof(payload_t);
+    payload_t *payload = NULL;
+    uint8_t idx = POOL_HEAP;
+    pool_t *fit = NULL;
+    for (int i = 0; i < sizeof(pool)/sizeof(pool_t) && !payload; ++i) {
+        if (size <= pool[i].size) {
+            fit = fit ? fit : &pool[i];
+            if ((payload = msg_pool_alloc(&pool[i]))) {
+                idx = i;
+            }
         }
     }
-    xSemaphoreGive(mutex);
+    if (!payload) {
+        if (fit) {
+            atomic_fetch_add_explicit(&fit->failed, 1, memory_order_relaxed);
+        }
+        // malloc may hand out PSRAM with SPIRAM_USE_MALLOC
+        if (!(payload = heap_caps_malloc(size, HEAP_CAPS))) {
+            return NULL;
+        }
+    }
+    payload->free = free;
+    payload->pool = idx;
+    atomic_init(msg_refs(payload), 1);
+    return payload + 1;
 }
 
-void msg_free(msg_t *msg) {
-    assert(msg->ptr);
-    if (msg->free) {
-        msg->free(msg->ptr);
+void msg_release(void *ptr) {
+    assert(ptr);
+    payload_t *payload = (payload_t *)ptr - 1;
+    if (atomic_fetch_sub_explicit(msg_refs(payload), 1, memory_order_acq_rel) == 1) {
+        if (payload->free) {
+            payload->free(ptr);
+        }
+        if (payload->pool == POOL_HEAP) {
+            free(payload);
+        } else {
+            msg_pool_free(&pool[payload->pool], payload);
+        }
     }
-    free(msg->ptr);
+}
+
+void msg_send_ptr(msg_type_t msg_type, void *ptr) {
+    assert(ptr);
+    msg_t msg = {
+        .type = msg_type,
+        .is_ptr = true,
+        .ptr = ptr
+    };
+    msg_send(&msg, NULL);
+    // drop the sender's reference, the payload now lives as long as any receiver holds it
+    msg_free(&msg);
+}
+
+void msg_free(msg_t *msg) {
+    msg_release(msg->ptr);
     msg->ptr = NULL;
 }
 
 msg_t msg_receive(msg_handle_t handle) {
-    assert(handle < MAX_HANDLES);
     msg_t msg;
-    assert(xQueueReceive(receiver[handle].queue, &msg, portMAX_DELAY) == pdPASS);
+    msg_wait(&handle, 1, &msg, portMAX_DELAY);
     return msg;
 }
 
+size_t msg_receive_batch(msg_handle_t handle, msg_t *msgs, size_t max, uint32_t timeout_ms) {
+    assert(max);
+    if (msg_wait(&handle, 1, msgs, msg_ticks(timeout_ms)) < 0) {
+        return 0;
+    }
+    receiver_t *rcv = &receiver[handle];
+    size_t cnt = 1;
+    while (cnt < max && msg_take(rcv, &msgs[cnt])) {
+        cnt++;
+    }
+    return cnt;
+}
+
+bool msg_receive_any(const msg_handle_t *handles, size_t cnt, msg_handle_t *from, msg_t *msg, uint32_t timeout_ms) {
+    int idx = msg_wait(handles, cnt, msg, msg_ticks(timeout_ms));
+    if (idx < 0) {
+        return false;
+    }
+    if (from) {
+        *from = handles[idx];
+    }
+    return true;
+}
+
+uint32_t msg_dropped(msg_handle_t handle) {
+    assert(handle < atomic_load(&next_handle));
+    return atomic_load_explicit(&receiver[handle].dropped, memory_order_relaxed);
+}
+
+size_t msg_pool_stats(msg_pool_stats_t *stats, size_t max) {
+    size_t cnt = sizeof(pool)/sizeof(pool_t);
+    for (int i = 0; i < cnt && i < max; ++i) {
+        stats[i].size = pool[i].size - sizeof(payload_t);
+        stats[i].blocks = pool[i].blocks;
+        stats[i].used = atomic_load_explicit(&pool[i].used, memory_order_relaxed);
+        stats[i].peak = atomic_load_explicit(&pool[i].peak, memory_order_relaxed);
+        stats[i].failed = atomic_load_explicit(&pool[i].failed, memory_order_relaxed);
+    }
+    return cnt;
+}
+
+bool msg_latest(msg_type_t msg_type, uint32_t *value) {
+    assert(msg_type && msg_type <= atomic_load(&next_type));
+    topic_t *tp = &topic[msg_type - 1];
+    assert(tp->conflate);
+    portENTER_CRITICAL_SAFE(&tp->lock);
+    bool valid = tp->valid;
+    *value = tp->latest;
+    portEXIT_CRITICAL_SAFE(&tp->lock);
+    return valid;
+}
+
+bool msg_stats_type(msg_type_t type, uint32_t *published) {
+    if (!type || type > atomic_load(&next_type)) {
+        return false;
+    }
+    *published = atomic_load_explicit(&topic[type - 1].published, memory_order_relaxed);
+    return true;
+}
+
+bool msg_stats_handle(msg_handle_t handle, msg_handle_stats_t *stats) {
+    if (handle >= atomic_load(&next_handle)) {
+        return false;
+    }
+    receiver_t *rcv = &receiver[handle];
+    stats->depth = 0;
+    for (int prio = 0; prio < MSG_PRIO_MAX; ++prio) {
+        ring_t *ring = &rcv->ring[prio];
+        stats->depth += atomic_load_explicit(&ring->head, memory_order_relaxed) - atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    }
+    stats->high_water = atomic_load_explicit(&rcv->high_water, memory_order_relaxed);
+    stats->received = atomic_load_explicit(&rcv->received, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&rcv->dropped, memory_order_relaxed);
+    for (int i = 0; i < MSG_LATENCY_BUCKETS; ++i) {
+        stats->latency[i] = atomic_load_explicit(&rcv->latency[i], memory_order_relaxed);
+    }
+    return true;
+}
+
 /***************************
 ***** LOCAL FUNCTIONS ******
 ***************************/
+
+static msg_handle_t msg_create(const msg_listen_cfg_t *cfg, msg_callback_t callback, void *ctx) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    msg_handle_t handle = atomic_load(&next_handle);
+    assert(handle < MAX_HANDLES);
+    receiver_t *rcv = &receiver[handle];
+    rcv->ring[MSG_PRIO_BULK].size = MAX_MESSAGES;
+    rcv->ring[MSG_PRIO_URGENT].size = MAX_URGENT;
+#ifdef CONFIG_MSG_STATIC
+    rcv->ring[MSG_PRIO_BULK].slot = bulk_slot[handle];
+    rcv->ring[MSG_PRIO_URGENT].slot = urgent_slot[handle];
+#else
+    for (int prio = 0; prio < MSG_PRIO_MAX; ++prio) {
+        ring_t *ring = &rcv->ring[prio];
+        ring->slot = calloc(ring->size, sizeof(slot_t));
+        assert(ring->slot);
+    }
+#endif
+    for (int prio = 0; prio < MSG_PRIO_MAX; ++prio) {
+        ring_t *ring = &rcv->ring[prio];
+        for (int i = 0; i < ring->size; ++i) {
+            atomic_init(&ring->slot[i].seq, i);
+        }
+    }
+    rcv->policy = cfg ? cfg->policy : MSG_DROP_NEWEST;
+    if (rcv->policy == MSG_BLOCK) {
+        rcv->timeout = msg_ticks(cfg->timeout_ms);
+#ifdef CONFIG_MSG_STATIC
+        rcv->space = xSemaphoreCreateCountingStatic(MAX_MESSAGES + MAX_URGENT, 0, &space_buf[handle]);
+#else
+        rcv->space = xSemaphoreCreateCounting(MAX_MESSAGES + MAX_URGENT, 0);
+#endif
+        assert(rcv->space);
+    }
+    rcv->callback = callback;
+    rcv->ctx = ctx;
+    // publish the receiver only after it is fully set up, senders don't lock
+    atomic_store_explicit(&next_handle, handle + 1, memory_order_release);
+    xSemaphoreGive(mutex);
+    return handle;
+}
+
+
+// woken is only set when called from an ISR
+static void msg_send(const msg_t *msg, BaseType_t *woken) {
+    assert(msg->type && msg->type <= CONFIG_MSG_MAX_TYPES);
+    topic_t *tp = &topic[msg->type - 1];
+    if (STATS) {
+        atomic_fetch_add_explicit(&tp->published, 1, memory_order_relaxed);
+    }
+    if (tp->conflate) {
+        msg_send_conflated(tp, msg, woken);
+        return;
+    }
+    subscription_t *sub = atomic_load_explicit(&tp->first, memory_order_acquire);
+    for (; sub; sub = sub->next) {
+        receiver_t *rcv = &receiver[sub->handle];
+        if (msg->is_ptr) {
+            msg_retain(msg->ptr);
+        }
+        if (msg_deliver(rcv, sub, msg, woken)) {
+            msg_wake(rcv, woken);
+        } else {
+            msg_t dropped = *msg;
+            msg_discard(rcv, &dropped);
+        }
+    }
+}
+
+// the topic lock keeps the latest value and the pending value of every
+// subscription in step, so a late subscriber never sees an older value
+static void msg_send_conflated(topic_t *tp, const msg_t *msg, BaseType_t *woken) {
+    assert(!msg->is_ptr);
+    portENTER_CRITICAL_SAFE(&tp->lock);
+    tp->latest = msg->value;
+    tp->valid = true;
+    subscription_t *first = atomic_load_explicit(&tp->first, memory_order_acquire);
+    for (subscription_t *sub = first; sub; sub = sub->next) {
+        receiver_t *rcv = &receiver[sub->handle];
+        if (!msg_coalesce(rcv, sub, msg, woken)) {
+            atomic_fetch_add_explicit(&rcv->dropped, 1, memory_order_relaxed);
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&tp->lock);
+    for (subscription_t *sub = first; sub; sub = sub->next) {
+        msg_wake(&receiver[sub->handle], woken);
+    }
+}
+
+// a callback receiver is queued for the dispatcher only once until it was drained
+static void msg_wake(receiver_t *rcv, BaseType_t *woken) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (rcv->callback) {
+        if (!atomic_exchange(&rcv->scheduled, true)) {
+            msg_handle_t handle = rcv - receiver;
+            if (woken) {
+                xQueueSendToBackFromISR(dispatch, &handle, woken);
+            } else {
+                xQueueSendToBack(dispatch, &handle, portMAX_DELAY);
+            }
+        }
+        return;
+    }
+    TaskHandle_t waiter = atomic_load_explicit(&rcv->waiter, memory_order_acquire);
+    if (waiter && woken) {
+        vTaskNotifyGiveIndexedFromISR(waiter, NOTIFY_INDEX, woken);
+    } else if (waiter) {
+        xTaskNotifyGiveIndexed(waiter, NOTIFY_INDEX);
+    }
+}
+
+static void msg_dispatch_task(void *param) {
+    for (;;) {
+        msg_handle_t handle;
+        xQueueReceive(dispatch, &handle, portMAX_DELAY);
+        receiver_t *rcv = &receiver[handle];
+        do {
+            msg_t msg;
+            while (msg_take(rcv, &msg)) {
+                rcv->callback(rcv->ctx, &msg);
+                if (msg.is_ptr) {
+                    msg_free(&msg);
+                }
+            }
+            atomic_store(&rcv->scheduled, false);
+            atomic_thread_fence(memory_order_seq_cst);
+        } while (msg_pending(rcv) && !atomic_exchange(&rcv->scheduled, true));
+    }
+}
+
+static bool msg_pending(receiver_t *rcv) {
+    for (int prio = 0; prio < MSG_PRIO_MAX; ++prio) {
+        ring_t *ring = &rcv->ring[prio];
+        if (atomic_load(&ring->head) != atomic_load(&ring->tail)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool msg_deliver(receiver_t *rcv, subscription_t *sub, const msg_t *msg, BaseType_t *woken) {
+    bool delivered;
+    // an ISR can neither wait for space nor free an evicted payload,
+    // msg_coalesce keeps a pending pointer message for the same reason
+    msg_policy_t policy = rcv->policy;
+    if (woken && policy != MSG_COALESCE) {
+        policy = MSG_DROP_NEWEST;
+    }
+    switch (policy) {
+        case MSG_DROP_OLDEST:
+            while (!(delivered = msg_push(rcv, sub->prio, msg))) {
+                msg_t oldest;
+                if (msg_pop(rcv, sub->prio, &oldest, NULL)) {
+                    msg_resolve(rcv, &oldest);
+                    msg_discard(rcv, &oldest);
+                }
+            }
+            break;
+        case MSG_BLOCK:
+            delivered = msg_push_wait(rcv, sub->prio, msg);
+            break;
+        case MSG_COALESCE:
+            delivered = msg_coalesce(rcv, sub, msg, woken);
+            break;
+        default:
+            delivered = msg_push(rcv, sub->prio, msg);
+            break;
+    }
+    return delivered;
+}
+
+static bool msg_push_wait(receiver_t *rcv, msg_prio_t prio, const msg_t *msg) {
+    bool pushed = msg_push(rcv, prio, msg);
+    if (!pushed) {
+        TickType_t ticks = rcv->timeout;
+        TimeOut_t timeout;
+        vTaskSetTimeOutState(&timeout);
+        // same handshake as the waiter in msg_receive, the other way round
+        atomic_fetch_add(&rcv->blocked, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        while (!(pushed = msg_push(rcv, prio, msg)) && xTaskCheckForTimeOut(&timeout, &ticks) == pdFALSE) {
+            xSemaphoreTake(rcv->space, ticks);
+        }
+        atomic_fetch_sub(&rcv->blocked, 1);
+    }
+    return pushed;
+}
+
+// a coalescing subscription keeps at most one marker in the ring, the marker
+// points back to the subscription which holds the latest message; the marker
+// is pushed under the lock, so pending always means a marker is queued and a
+// concurrent publisher can't replace a message whose marker did not fit; from
+// an ISR the new message is dropped rather than freeing a pending payload
+static bool msg_coalesce(receiver_t *rcv, subscription_t *sub, const msg_t *msg, bool isr) {
+    msg_t replaced = { 0 };
+    msg_t marker = {
+        .type = msg->type,
+        .ptr = sub
+    };
+    portENTER_CRITICAL_SAFE(&sub->lock);
+    bool pending = sub->pending;
+    if (pending && isr && sub->latest.is_ptr) {
+        portEXIT_CRITICAL_SAFE(&sub->lock);
+        return false;
+    }
+    if (!pending && !msg_push(rcv, sub->prio, &marker)) {
+        portEXIT_CRITICAL_SAFE(&sub->lock);
+        return false;
+    }
+    if (pending) {
+        replaced = sub->latest;
+    }
+    sub->latest = *msg;
+    sub->pending = true;
+    portEXIT_CRITICAL_SAFE(&sub->lock);
+
+    if (pending) {
+        msg_discard(rcv, &replaced);
+    }
+    return true;
+}
+
+// returns the index of the handle a message was taken from, handles earlier
+// in the list win, or -1 on timeout
+static int msg_wait(const msg_handle_t *handles, size_t cnt, msg_t *msg, TickType_t ticks) {
+    assert(cnt);
+    for (size_t i = 0; i < cnt; ++i) {
+        assert(handles[i] < atomic_load(&next_handle));
+        assert(!receiver[handles[i]].callback);
+    }
+    // announce the waiter before checking the rings, so a message pushed in
+    // between is never missed; stale notifications just cause another loop
+    // and only ever hit the index of the bus, not the one of the application;
+    // a handle has a single consumer, a second task waiting on it would steal
+    // the wakeups of the first
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    for (size_t i = 0; i < cnt; ++i) {
+        TaskHandle_t other = NULL;
+        atomic_compare_exchange_strong(&receiver[handles[i]].waiter, &other, self);
+        assert(!other);
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+    int idx = -1;
+    for (;;) {
+        for (size_t i = 0; i < cnt && idx < 0; ++i) {
+            if (msg_take(&receiver[handles[i]], msg)) {
+                idx = i;
+            }
+        }
+        if (idx >= 0 || xTaskCheckForTimeOut(&timeout, &ticks) != pdFALSE) {
+            break;
+        }
+        ulTaskNotifyTakeIndexed(NOTIFY_INDEX, pdTRUE, ticks);
+    }
+
+    for (size_t i = 0; i < cnt; ++i) {
+        atomic_store(&receiver[handles[i]].waiter, NULL);
+    }
+    return idx;
+}
+
+static bool msg_take(receiver_t *rcv, msg_t *msg) {
+    uint32_t stamp;
+    int prio = MSG_PRIO_MAX - 1;
+    while (!msg_pop(rcv, prio, msg, &stamp)) {
+        if (prio-- == 0) {
+            return false;
+        }
+    }
+    if (STATS) {
+        uint32_t us = (uint32_t)esp_timer_get_time() - stamp;
+        int bucket = us < 2 ? 0 : 31 - __builtin_clz(us);
+        if (bucket >= MSG_LATENCY_BUCKETS) {
+            bucket = MSG_LATENCY_BUCKETS - 1;
+        }
+        atomic_fetch_add_explicit(&rcv->latency[bucket], 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&rcv->received, 1, memory_order_relaxed);
+    }
+    msg_resolve(rcv, msg);
+    if (rcv->space) {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&rcv->blocked, memory_order_relaxed)) {
+            xSemaphoreGive(rcv->space);
+        }
+    }
+    return true;
+}
+
+// replaces a coalescing marker with the message it stands for
+static void msg_resolve(receiver_t *rcv, msg_t *msg) {
+    if (rcv->policy == MSG_COALESCE || topic[msg->type - 1].conflate) {
+        subscription_t *sub = msg->ptr;
+        portENTER_CRITICAL_SAFE(&sub->lock);
+        *msg = sub->latest;
+        sub->pending = false;
+        portEXIT_CRITICAL_SAFE(&sub->lock);
+    }
+}
+
+static void msg_discard(receiver_t *rcv, msg_t *msg) {
+    atomic_fetch_add_explicit(&rcv->dropped, 1, memory_order_relaxed);
+    if (msg->is_ptr) {
+        msg_free(msg);
+    }
+}
+
+static void msg_retain(void *ptr) {
+    payload_t *payload = (payload_t *)ptr - 1;
+    atomic_fetch_add_explicit(msg_refs(payload), 1, memory_order_relaxed);
+}
+
+static atomic_uint *msg_refs(payload_t *payload) {
+    if (payload->pool == POOL_HEAP) {
+        return &payload->refs;
+    }
+    pool_t *p = &pool[payload->pool];
+    return &p->refs[((uint8_t *)payload - p->mem) / p->size];
+}
+
+static TickType_t msg_ticks(uint32_t ms) {
+    return ms == portMAX_DELAY ? portMAX_DELAY : pdMS_TO_TICKS(ms);
+}
+
+static payload_t *msg_pool_alloc(pool_t *p) {
+    for (int w = 0; w * 32 < p->blocks; ++w) {
+        unsigned int valid = p->blocks - w * 32 >= 32 ? ~0u : (1u << (p->blocks - w * 32)) - 1;
+        unsigned int map = atomic_load_explicit(&p->map[w], memory_order_relaxed);
+        while (~map & valid) {
+            int bit = __builtin_ctz(~map & valid);
+            if (atomic_compare_exchange_weak_explicit(&p->map[w], &map, map | (1u << bit), memory_order_acquire, memory_order_relaxed)) {
+                msg_peak(&p->peak, atomic_fetch_add_explicit(&p->used, 1, memory_order_relaxed) + 1);
+                return (payload_t *)(p->mem + (w * 32 + bit) * p->size);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void msg_pool_free(pool_t *p, payload_t *payload) {
+    int idx = ((uint8_t *)payload - p->mem) / p->size;
+    atomic_fetch_sub_explicit(&p->used, 1, memory_order_relaxed);
+    atomic_fetch_and_explicit(&p->map[idx / 32], ~(1u << (idx % 32)), memory_order_release);
+}
+
+static void msg_peak(atomic_uint *peak, unsigned int value) {
+    unsigned int old = atomic_load_explicit(peak, memory_order_relaxed);
+    while (value > old && !atomic_compare_exchange_weak_explicit(peak, &old, value, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static bool msg_push(receiver_t *rcv, msg_prio_t prio, const msg_t *msg) {
+    ring_t *ring = &rcv->ring[prio];
+    unsigned int pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (;;) {
+        slot_t *slot = &ring->slot[pos & (ring->size - 1)];
+        int diff = (int)(atomic_load_explicit(&slot->seq, memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                slot->msg = *msg;
+                if (STATS) {
+                    slot->stamp = (uint32_t)esp_timer_get_time();
+                    msg_peak(&rcv->high_water, pos + 1 - atomic_load_explicit(&ring->tail, memory_order_relaxed));
+                }
+                atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+}
+
+static bool msg_pop(receiver_t *rcv, msg_prio_t prio, msg_t *msg, uint32_t *stamp) {
+    ring_t *ring = &rcv->ring[prio];
+    unsigned int pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    for (;;) {
+        slot_t *slot = &ring->slot[pos & (ring->size - 1)];
+        int diff = (int)(atomic_load_explicit(&slot->seq, memory_order_acquire) - (pos + 1));
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                *msg = slot->msg;
+                if (stamp) {
+                    *stamp = slot->stamp;
+                }
+                atomic_store_explicit(&slot->seq, pos + ring->size, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+}